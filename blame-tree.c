@@ -0,0 +1,466 @@
+/* blame-tree.c: the last commit changing each entry of a tree listing
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The history of a directory is walked once, newest commits first, and
+ * each commit is compared to its parents one directory level deep, so all
+ * entries are resolved by the same walk. Every queued commit carries the
+ * entries it is responsible for. An entry which is unchanged in a parent
+ * is passed on to the first such parent only, and the other parents are
+ * not followed for it. An entry which differs from all parents is blamed
+ * on the commit. The walk stops as soon as every entry has been resolved,
+ * or when "max-lastcommit-time" is used up, leaving the rest unknown.
+ *
+ * If the page cache is enabled, the result is saved in the cache root.
+ * Like the pages, the results use at most cache-size files, the slot being
+ * chosen by a hash of the commit, the tree and the path of the listing. A
+ * later listing of the same tree at the same commit only reads that file.
+ * A walk which ran out of time also saves the commits still queued, with
+ * the entries each is responsible for, and the next listing continues the
+ * walk from there instead of starting over.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       4 x uint32: magic, version, number of entries, number of
+ *                queued commits
+ *   key          sha1 of the commit, the tree and the path of the listing
+ *   entries      per tree entry, in tree order: sha1 of the last commit
+ *                changing it (null if unknown), uint32 commit date
+ *   queue        per queued commit: its sha1, one byte per tree entry
+ *                which is 1 if the commit is responsible for the entry
+ *   subjects     one NUL-terminated commit subject per tree entry
+ */
+
+#include "cgit.h"
+#include "blame-tree.h"
+
+#define BLAME_MAGIC    0x43424c54 /* "CBLT" */
+#define BLAME_VERSION  2
+
+struct blame_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr;
+	uint32_t nr_queued;
+	unsigned char key[20];
+};
+
+/* The state of one entry while walking the history */
+struct blame_state {
+	struct blame_tree_entry *entry;
+	int stamp;
+};
+
+static struct string_list names;
+static int stamp;
+
+static void blame_key(struct commit *commit, const char *path,
+		      const unsigned char *tree_sha1, unsigned char *key)
+{
+	git_SHA_CTX c;
+
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, commit->object.sha1, 20);
+	git_SHA1_Update(&c, tree_sha1, 20);
+	git_SHA1_Update(&c, path, strlen(path));
+	git_SHA1_Final(key, &c);
+}
+
+static const char *blame_path(const unsigned char *key)
+{
+	uint32_t hash;
+
+	memcpy(&hash, key, sizeof(hash));
+	return fmt("%s/blame-%x", ctx.cfg.cache_root,
+		   ntohl(hash) % ctx.cfg.cache_size);
+}
+
+void cgit_free_blame_tree(struct blame_tree_entry *entries, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		free(entries[i].subject);
+		entries[i].subject = NULL;
+	}
+}
+
+/* Make `commit` responsible for the entries flagged in `pass`, which it
+ * holds in its util, and queue it if it is not queued yet.
+ */
+static void pass_on(struct commit *commit, const char *pass, int nr,
+		    struct commit_list **queue)
+{
+	char *active = commit->util;
+	int i;
+
+	if (!active) {
+		active = commit->util = xcalloc(nr, 1);
+		insert_by_date(commit, queue);
+	}
+	for (i = 0; i < nr; i++)
+		active[i] |= pass[i];
+}
+
+/* Fill `entries` from the saved result and queue the commits of a walk
+ * which ran out of time. Return 0 on success and -1 if there is no valid
+ * result, with nothing queued.
+ */
+static int read_blame(const char *file, const unsigned char *key,
+		      struct blame_tree_entry *entries, int nr,
+		      struct commit_list **queue)
+{
+	const struct blame_header *hdr;
+	const char *p, *end;
+	struct commit *commit;
+	char *buf;
+	size_t size, avail;
+	uint32_t date, nr_queued;
+	int i;
+
+	if (readfile(file, &buf, &size))
+		return -1;
+	hdr = (const struct blame_header *)buf;
+	if (size < sizeof(*hdr) || ntohl(hdr->magic) != BLAME_MAGIC ||
+	    ntohl(hdr->version) != BLAME_VERSION || ntohl(hdr->nr) != nr ||
+	    hashcmp(hdr->key, key))
+		goto fail;
+	avail = size - sizeof(*hdr);
+	nr_queued = ntohl(hdr->nr_queued);
+	if (avail / 24 < nr ||
+	    nr_queued > (avail - (size_t)nr * 24) / (20 + nr))
+		goto fail;
+	p = buf + sizeof(*hdr);
+	for (i = 0; i < nr; i++, p += 24) {
+		hashcpy(entries[i].commit, (const unsigned char *)p);
+		memcpy(&date, p + 20, 4);
+		entries[i].date = ntohl(date);
+	}
+	p += (size_t)nr_queued * (20 + nr);
+	end = buf + size;
+	for (i = 0; i < nr; i++) {
+		if (p >= end || !memchr(p, '\0', end - p))
+			goto fail;
+		entries[i].subject = is_null_sha1(entries[i].commit) ?
+			NULL : xstrdup(p);
+		p += strlen(p) + 1;
+	}
+	p = buf + sizeof(*hdr) + nr * 24;
+	for (; nr_queued; nr_queued--, p += 20 + nr) {
+		commit = lookup_commit((const unsigned char *)p);
+		if (commit && !parse_commit(commit))
+			pass_on(commit, p + 20, nr, queue);
+	}
+	free(buf);
+	return 0;
+fail:
+	free(buf);
+	cgit_free_blame_tree(entries, nr);
+	return -1;
+}
+
+/* Save the result and the commits left in `queue`, return 0 on success
+ * and errno otherwise.
+ */
+static int write_blame(const char *file, const unsigned char *key,
+		       struct blame_tree_entry *entries, int nr,
+		       struct commit_list *queue)
+{
+	struct blame_header hdr;
+	struct strbuf sb = STRBUF_INIT;
+	struct commit_list *item;
+	uint32_t date;
+	char *path, *lock;
+	int fd, i, err = 0;
+
+	for (item = queue, i = 0; item; item = item->next)
+		i++;
+	hdr.magic = htonl(BLAME_MAGIC);
+	hdr.version = htonl(BLAME_VERSION);
+	hdr.nr = htonl(nr);
+	hdr.nr_queued = htonl(i);
+	hashcpy(hdr.key, key);
+	strbuf_add(&sb, &hdr, sizeof(hdr));
+	for (i = 0; i < nr; i++) {
+		date = htonl(entries[i].date);
+		strbuf_add(&sb, entries[i].commit, 20);
+		strbuf_add(&sb, &date, sizeof(date));
+	}
+	for (item = queue; item; item = item->next) {
+		strbuf_add(&sb, item->item->object.sha1, 20);
+		strbuf_add(&sb, item->item->util, nr);
+	}
+	for (i = 0; i < nr; i++)
+		strbuf_add(&sb, entries[i].subject,
+			   strlen(entries[i].subject) + 1);
+
+	path = xstrdup(file);
+	lock = xstrdup(fmt("%s.lock", path));
+	fd = cgit_open_lock(lock);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+	if (write_in_full(fd, sb.buf, sb.len) < 0)
+		err = errno;
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	close(fd);
+out:
+	free(lock);
+	free(path);
+	strbuf_release(&sb);
+	return err;
+}
+
+/* Store the sha1 of the directory `path` in `commit`, or a null sha1 if
+ * there is no such directory.
+ */
+static void subtree(struct commit *commit, const char *path,
+		    unsigned char *sha1)
+{
+	unsigned mode;
+
+	if (!*path)
+		hashcpy(sha1, commit->tree->object.sha1);
+	else if (get_tree_entry(commit->tree->object.sha1, path, sha1, &mode) ||
+		 !S_ISDIR(mode))
+		hashclr(sha1);
+}
+
+static void *read_subtree(const unsigned char *sha1, unsigned long *size)
+{
+	enum object_type type;
+	void *buf;
+
+	*size = 0;
+	if (is_null_sha1(sha1))
+		return NULL;
+	buf = read_sha1_file(sha1, &type, size);
+	if (buf && type != OBJ_TREE) {
+		free(buf);
+		buf = NULL;
+		*size = 0;
+	}
+	return buf;
+}
+
+static void touch(const char *name)
+{
+	struct string_list_item *item;
+	struct blame_state *state;
+
+	item = string_list_lookup(&names, name);
+	if (!item)
+		return;
+	state = item->util;
+	state->stamp = stamp;
+}
+
+/* Touch the entries which differ between the trees `sha1` and `parent`,
+ * i.e. set their stamp to the new value of `stamp`.
+ */
+static void compare_trees(const unsigned char *sha1,
+			  const unsigned char *parent)
+{
+	struct tree_desc desc1, desc2;
+	struct name_entry e1, e2;
+	unsigned long size1, size2;
+	void *buf1, *buf2;
+	int more1, more2, cmp;
+
+	stamp++;
+	buf1 = read_subtree(sha1, &size1);
+	buf2 = read_subtree(parent, &size2);
+	init_tree_desc(&desc1, buf1, size1);
+	init_tree_desc(&desc2, buf2, size2);
+	more1 = tree_entry(&desc1, &e1);
+	more2 = tree_entry(&desc2, &e2);
+	while (more1 || more2) {
+		if (!more2)
+			cmp = -1;
+		else if (!more1)
+			cmp = 1;
+		else
+			cmp = base_name_compare(e1.path,
+						tree_entry_len(e1.path, e1.sha1),
+						e1.mode, e2.path,
+						tree_entry_len(e2.path, e2.sha1),
+						e2.mode);
+		if (cmp < 0) {
+			touch(e1.path);
+			more1 = tree_entry(&desc1, &e1);
+		} else if (cmp > 0) {
+			touch(e2.path);
+			more2 = tree_entry(&desc2, &e2);
+		} else {
+			if (hashcmp(e1.sha1, e2.sha1) || e1.mode != e2.mode)
+				touch(e1.path);
+			more1 = tree_entry(&desc1, &e1);
+			more2 = tree_entry(&desc2, &e2);
+		}
+	}
+	free(buf1);
+	free(buf2);
+}
+
+static char *commit_subject(struct commit *commit)
+{
+	const char *p, *end;
+
+	if (!commit->buffer || !(p = strstr(commit->buffer, "\n\n")))
+		return xstrdup("");
+	p += 2;
+	end = strchrnul(p, '\n');
+	return xstrndup(p, end - p);
+}
+
+static void blame(struct blame_tree_entry *entry, struct commit *commit,
+		  char **subject)
+{
+	if (!*subject)
+		*subject = commit_subject(commit);
+	hashcpy(entry->commit, commit->object.sha1);
+	entry->date = commit->date;
+	entry->subject = xstrdup(*subject);
+}
+
+static void clear_queue(struct commit_list **queue)
+{
+	struct commit *commit;
+
+	while (*queue) {
+		commit = pop_commit(queue);
+		free(commit->util);
+		commit->util = NULL;
+	}
+}
+
+/* Blame the entries of `states` which are still unknown on the commits
+ * last changing them, walking from the commits in `queue`. If the time
+ * runs out, the commits still to be walked are left in `queue`.
+ */
+static void walk_history(struct commit_list **queue, const char *path,
+			struct blame_state *states, int nr)
+{
+	struct commit_list *parent;
+	struct commit *commit;
+	unsigned char sha1[20], parent_sha1[20];
+	char *active, *pass, *subject;
+	time_t start = time(NULL);
+	int i, left, passed, unresolved = 0;
+
+	for (i = 0; i < nr; i++)
+		if (is_null_sha1(states[i].entry->commit))
+			unresolved++;
+	pass = xmalloc(nr);
+	while (unresolved && *queue) {
+		if (ctx.cfg.max_lastcommit_time &&
+		    time(NULL) - start >= ctx.cfg.max_lastcommit_time)
+			break;
+		commit = pop_commit(queue);
+		active = commit->util;
+		commit->util = NULL;
+		if (parse_commit(commit)) {
+			free(active);
+			continue;
+		}
+		subtree(commit, path, sha1);
+		for (i = 0, left = 0; i < nr; i++)
+			left += active[i];
+		for (parent = commit->parents; parent && left;
+		     parent = parent->next) {
+			if (parse_commit(parent->item))
+				continue;
+			subtree(parent->item, path, parent_sha1);
+			if (!hashcmp(sha1, parent_sha1)) {
+				pass_on(parent->item, active, nr, queue);
+				memset(active, 0, nr);
+				left = 0;
+				break;
+			}
+			compare_trees(sha1, parent_sha1);
+			for (i = 0, passed = 0; i < nr; i++) {
+				pass[i] = active[i] && states[i].stamp != stamp;
+				if (pass[i]) {
+					active[i] = 0;
+					passed++;
+				}
+			}
+			if (passed)
+				pass_on(parent->item, pass, nr, queue);
+			left -= passed;
+		}
+		subject = NULL;
+		for (i = 0; left && i < nr; i++) {
+			if (!active[i])
+				continue;
+			blame(states[i].entry, commit, &subject);
+			unresolved--;
+			left--;
+		}
+		free(subject);
+		free(active);
+		free(commit->buffer);
+		commit->buffer = NULL;
+	}
+	free(pass);
+	if (!unresolved)
+		clear_queue(queue);
+}
+
+void cgit_blame_tree(struct commit *commit, const char *path,
+		     const unsigned char *tree_sha1,
+		     struct blame_tree_entry *entries, int nr)
+{
+	struct commit_list *queue = NULL;
+	struct blame_state *states;
+	struct string_list_item *item;
+	unsigned char key[20];
+	char *dir, *file = NULL, *pass;
+	int i;
+
+	if (!nr)
+		return;
+	dir = xstrdup(path ? path : "");
+	for (i = strlen(dir); i > 0 && dir[i - 1] == '/'; i--)
+		dir[i - 1] = '\0';
+	blame_key(commit, dir, tree_sha1, key);
+	if (ctx.cfg.cache_size > 0)
+		file = xstrdup(blame_path(key));
+	if (!file || read_blame(file, key, entries, nr, &queue)) {
+		for (i = 0; i < nr; i++) {
+			hashclr(entries[i].commit);
+			entries[i].date = 0;
+			entries[i].subject = NULL;
+		}
+		pass = xmalloc(nr);
+		memset(pass, 1, nr);
+		pass_on(commit, pass, nr, &queue);
+		free(pass);
+	} else if (!queue)
+		goto out;
+
+	states = xcalloc(nr, sizeof(*states));
+	for (i = 0; i < nr; i++) {
+		states[i].entry = &entries[i];
+		item = string_list_insert(&names, entries[i].name);
+		item->util = &states[i];
+	}
+	walk_history(&queue, dir, states, nr);
+	for (i = 0; i < nr; i++)
+		if (!entries[i].subject)
+			entries[i].subject = xstrdup("");
+	if (file && !access(ctx.cfg.cache_root, W_OK))
+		write_blame(file, key, entries, nr, queue);
+	clear_queue(&queue);
+	string_list_clear(&names, 0);
+	free(states);
+out:
+	free(file);
+	free(dir);
+}
@@ -0,0 +1,26 @@
+#ifndef BLAME_TREE_H
+#define BLAME_TREE_H
+
+#include "cgit.h"
+
+/* The last commit which changed one entry of a tree listing. The commit is
+ * a null sha1 if it could not be found.
+ */
+struct blame_tree_entry {
+	const char *name;
+	unsigned char commit[20];
+	unsigned long date;
+	char *subject;
+};
+
+/* Find the last commits changing the `nr` entries (with `name` set, in tree
+ * order) of the tree `tree_sha1`, which is found at `path` in `commit`, or
+ * take them from the result saved in the cache root, continuing its walk
+ * if it ran out of time.
+ */
+extern void cgit_blame_tree(struct commit *commit, const char *path,
+			    const unsigned char *tree_sha1,
+			    struct blame_tree_entry *entries, int nr);
+extern void cgit_free_blame_tree(struct blame_tree_entry *entries, int nr);
+
+#endif /* BLAME_TREE_H */
@@ -0,0 +1,435 @@
+/* bloom.c: changed-path Bloom filters for path-limited history walks
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The filters are stored in a sidecar file in the repository, generated
+ * by `cgit --build-index`. For every commit reachable from any ref there
+ * is a Bloom filter holding the paths changed compared to the first
+ * parent (or the empty tree for root commits), including all leading
+ * directories of those paths. If a path is not in the filter, the commit
+ * did not touch it, and the tree diff can be skipped.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       4 x uint32: magic, version, commits, size of filter data
+ *   fanout       256 x uint32: number of commits with a first sha1 byte
+ *                less than or equal to the index
+ *   sha1         one 20-byte sha1 per commit, sorted
+ *   end          one uint32 per commit: end offset of its filter
+ *   data         the filters, concatenated
+ *
+ * A filter is BLOOM_BITS_PER_PATH bits per path, rounded up to whole
+ * bytes, with BLOOM_HASHES bits set for each path. A commit changing no
+ * paths gets a single zero byte, a commit changing more than
+ * BLOOM_MAX_PATHS paths a single 0xff byte, matching any path.
+ */
+
+#include "cgit.h"
+#include "bloom.h"
+#include "commit-graph.h"
+
+#define BLOOM_MAGIC         0x43424c4d /* "CBLM" */
+#define BLOOM_VERSION       1
+#define BLOOM_FILE          "info/cgit/path-bloom"
+#define BLOOM_HASHES        7
+#define BLOOM_BITS_PER_PATH 10
+#define BLOOM_MAX_PATHS     512
+
+struct bloom_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_commits;
+	uint32_t data_size;
+};
+
+struct path_bloom {
+	void *map;
+	size_t size;
+	uint32_t nr_commits;
+	uint32_t data_size;
+	const uint32_t *fanout;
+	const unsigned char *sha1;
+	const uint32_t *end;
+	const unsigned char *data;
+};
+
+static uint32_t rotl(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+/* The 32-bit variant of MurmurHash3 */
+static uint32_t murmur3(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t h = seed, k;
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		k = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) |
+			((uint32_t)p[i + 3] << 24);
+		k = rotl(k * c1, 15) * c2;
+		h = rotl(h ^ k, 13) * 5 + 0xe6546b64;
+	}
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= p[i + 2] << 16;
+	case 2:
+		k ^= p[i + 1] << 8;
+	case 1:
+		k ^= p[i];
+		h ^= rotl(k * c1, 15) * c2;
+	}
+	h ^= len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/* Compute the bit positions of a path in a filter of `bits` bits */
+static void path_hashes(const char *path, size_t len, uint32_t bits,
+			uint32_t *pos)
+{
+	uint32_t h1, h2;
+	int i;
+
+	h1 = murmur3(0x293ae76f, path, len);
+	h2 = murmur3(0x7e646e2c, path, len);
+	for (i = 0; i < BLOOM_HASHES; i++)
+		pos[i] = (h1 + i * h2) % bits;
+}
+
+struct path_bloom *cgit_open_path_bloom(void)
+{
+	struct path_bloom *bloom;
+	const struct bloom_header *hdr;
+	struct stat st;
+	uint64_t expected;
+	uint32_t i, ofs;
+	int fd;
+
+	fd = open(git_path(BLOOM_FILE), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	bloom = xcalloc(1, sizeof(*bloom));
+	bloom->size = st.st_size;
+	bloom->map = mmap(NULL, bloom->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bloom->map == MAP_FAILED) {
+		free(bloom);
+		return NULL;
+	}
+	hdr = bloom->map;
+	bloom->nr_commits = ntohl(hdr->nr_commits);
+	bloom->data_size = ntohl(hdr->data_size);
+	expected = sizeof(*hdr) + 256 * sizeof(uint32_t) +
+		(uint64_t)bloom->nr_commits * (20 + sizeof(uint32_t)) +
+		bloom->data_size;
+	if (ntohl(hdr->magic) != BLOOM_MAGIC ||
+	    ntohl(hdr->version) != BLOOM_VERSION ||
+	    expected != bloom->size) {
+		cgit_close_path_bloom(bloom);
+		return NULL;
+	}
+	bloom->fanout = (const uint32_t *)(hdr + 1);
+	bloom->sha1 = (const unsigned char *)(bloom->fanout + 256);
+	bloom->end = (const uint32_t *)(bloom->sha1 + 20 * bloom->nr_commits);
+	bloom->data = (const unsigned char *)(bloom->end + bloom->nr_commits);
+
+	for (i = 1; i < 256; i++)
+		if (ntohl(bloom->fanout[i]) < ntohl(bloom->fanout[i - 1]))
+			break;
+	if (i < 256 || ntohl(bloom->fanout[255]) != bloom->nr_commits) {
+		cgit_close_path_bloom(bloom);
+		return NULL;
+	}
+	for (i = 0, ofs = 0; i < bloom->nr_commits; i++) {
+		if (ntohl(bloom->end[i]) <= ofs ||
+		    ntohl(bloom->end[i]) > bloom->data_size)
+			break;
+		ofs = ntohl(bloom->end[i]);
+	}
+	if (i < bloom->nr_commits) {
+		cgit_close_path_bloom(bloom);
+		return NULL;
+	}
+	return bloom;
+}
+
+void cgit_close_path_bloom(struct path_bloom *bloom)
+{
+	if (!bloom)
+		return;
+	munmap(bloom->map, bloom->size);
+	free(bloom);
+}
+
+/* Find the filter of a commit, return its size or 0 if there is none */
+static uint32_t find_filter(struct path_bloom *bloom,
+			    const unsigned char *sha1,
+			    const unsigned char **filter)
+{
+	uint32_t lo, hi, mid, start;
+	int cmp;
+
+	if (!bloom)
+		return 0;
+	lo = sha1[0] ? ntohl(bloom->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(bloom->fanout[sha1[0]]);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = hashcmp(bloom->sha1 + 20 * mid, sha1);
+		if (!cmp) {
+			start = mid ? ntohl(bloom->end[mid - 1]) : 0;
+			*filter = bloom->data + start;
+			return ntohl(bloom->end[mid]) - start;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+int cgit_path_bloom_check(struct path_bloom *bloom, const unsigned char *sha1,
+			  const char *path)
+{
+	const unsigned char *filter;
+	uint32_t size, pos[BLOOM_HASHES];
+	size_t len;
+	int i;
+
+	size = find_filter(bloom, sha1, &filter);
+	if (!size)
+		return -1;
+	len = strlen(path);
+	while (len && path[len - 1] == '/')
+		len--;
+	if (!len)
+		return 1;
+	path_hashes(path, len, size * 8, pos);
+	for (i = 0; i < BLOOM_HASHES; i++)
+		if (!(filter[pos[i] / 8] & (1 << (pos[i] % 8))))
+			return 0;
+	return 1;
+}
+
+struct bloom_builder {
+	struct path_bloom *old;
+	struct commit_graph *graph;
+	struct commit_list *stack;
+	struct commit **commits;
+	int commits_nr;
+	int commits_alloc;
+	uint32_t *end;
+	struct strbuf data;
+	struct diff_options diffopt;
+};
+
+static void fill_commit(struct bloom_builder *b, struct commit *commit)
+{
+	if (cgit_commit_graph_fill(b->graph, commit, NULL) &&
+	    parse_commit(commit))
+		die("Unable to parse commit %s",
+		    sha1_to_hex(commit->object.sha1));
+	if (!commit->tree)
+		die("Missing tree in commit %s",
+		    sha1_to_hex(commit->object.sha1));
+	free(commit->buffer);
+	commit->buffer = NULL;
+}
+
+static void push_commit(struct bloom_builder *b, struct commit *commit)
+{
+	if (commit->object.flags & SEEN)
+		return;
+	commit->object.flags |= SEEN;
+	commit_list_insert(commit, &b->stack);
+}
+
+static int bloom_ref_cb(const char *refname, const unsigned char *sha1,
+			int flags, void *cb_data)
+{
+	struct commit *commit;
+
+	commit = lookup_commit_reference_gently(sha1, 1);
+	if (commit)
+		push_commit(cb_data, commit);
+	return 0;
+}
+
+static void collect_commits(struct bloom_builder *b)
+{
+	struct commit *commit;
+	struct commit_list *p;
+
+	while (b->stack) {
+		commit = pop_commit(&b->stack);
+		fill_commit(b, commit);
+		ALLOC_GROW(b->commits, b->commits_nr + 1, b->commits_alloc);
+		b->commits[b->commits_nr++] = commit;
+		for (p = commit->parents; p; p = p->next)
+			push_commit(b, p->item);
+	}
+}
+
+static int cmp_commit_sha1(const void *a, const void *b)
+{
+	const struct commit *c1 = *(const struct commit **)a;
+	const struct commit *c2 = *(const struct commit **)b;
+
+	return hashcmp(c1->object.sha1, c2->object.sha1);
+}
+
+/* Add a changed path and all its leading directories */
+static void add_path(struct string_list *paths, const char *path)
+{
+	const char *p;
+
+	for (p = path; (p = strchr(p, '/')) != NULL; p++)
+		string_list_insert(paths, fmt("%.*s", (int)(p - path), path));
+	string_list_insert(paths, path);
+}
+
+static void add_filter(struct bloom_builder *b, struct commit *commit)
+{
+	struct string_list paths;
+	struct commit *parent;
+	uint32_t size, pos[BLOOM_HASHES];
+	unsigned char *filter;
+	int i, j;
+
+	memset(&paths, 0, sizeof(paths));
+	paths.strdup_strings = 1;
+	if (commit->parents) {
+		parent = commit->parents->item;
+		fill_commit(b, parent);
+		diff_tree_sha1(parent->tree->object.sha1,
+			       commit->tree->object.sha1, "", &b->diffopt);
+	} else
+		diff_root_tree_sha1(commit->tree->object.sha1, "",
+				    &b->diffopt);
+	for (i = 0; i < diff_queued_diff.nr; i++)
+		add_path(&paths, diff_queued_diff.queue[i]->two->path);
+	diff_flush(&b->diffopt);
+
+	if (paths.nr > BLOOM_MAX_PATHS) {
+		strbuf_addch(&b->data, 0xff);
+	} else {
+		size = (paths.nr * BLOOM_BITS_PER_PATH + 7) / 8;
+		if (!size)
+			size = 1;
+		filter = xcalloc(size, 1);
+		for (i = 0; i < paths.nr; i++) {
+			path_hashes(paths.items[i].string,
+				    strlen(paths.items[i].string), size * 8,
+				    pos);
+			for (j = 0; j < BLOOM_HASHES; j++)
+				filter[pos[j] / 8] |= 1 << (pos[j] % 8);
+		}
+		strbuf_add(&b->data, filter, size);
+		free(filter);
+	}
+	string_list_clear(&paths, 0);
+}
+
+static int write_filters(struct bloom_builder *b, int fd)
+{
+	struct bloom_header hdr;
+	const unsigned char *filter;
+	uint32_t fanout[256], size;
+	int i, j;
+
+	qsort(b->commits, b->commits_nr, sizeof(*b->commits),
+	      cmp_commit_sha1);
+	b->end = xcalloc(b->commits_nr + 1, sizeof(uint32_t));
+	for (i = 0; i < b->commits_nr; i++) {
+		size = find_filter(b->old, b->commits[i]->object.sha1,
+				   &filter);
+		if (size)
+			strbuf_add(&b->data, filter, size);
+		else
+			add_filter(b, b->commits[i]);
+		b->end[i] = htonl(b->data.len);
+	}
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < b->commits_nr &&
+		       b->commits[j]->object.sha1[0] <= i)
+			j++;
+		fanout[i] = htonl(j);
+	}
+
+	hdr.magic = htonl(BLOOM_MAGIC);
+	hdr.version = htonl(BLOOM_VERSION);
+	hdr.nr_commits = htonl(b->commits_nr);
+	hdr.data_size = htonl(b->data.len);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, fanout, sizeof(fanout)) < 0)
+		return errno;
+	for (i = 0; i < b->commits_nr; i++)
+		if (write_in_full(fd, b->commits[i]->object.sha1, 20) < 0)
+			return errno;
+	if (write_in_full(fd, b->end, b->commits_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->data.buf, b->data.len) < 0)
+		return errno;
+	return 0;
+}
+
+/* Generate the changed-path filters for all commits reachable from the
+ * refs of the current repository, reusing the filters which were already
+ * computed. Return 0 on success and errno otherwise.
+ */
+int cgit_write_path_bloom(void)
+{
+	struct bloom_builder b;
+	char *path, *lock;
+	int fd, err;
+
+	path = xstrdup(git_path(BLOOM_FILE));
+	lock = xstrdup(fmt("%s.lock", path));
+	if (safe_create_leading_directories(lock) ||
+	    (fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0) {
+		err = errno ? errno : EINVAL;
+		free(lock);
+		free(path);
+		return err;
+	}
+
+	memset(&b, 0, sizeof(b));
+	strbuf_init(&b.data, 0);
+	diff_setup(&b.diffopt);
+	DIFF_OPT_SET(&b.diffopt, RECURSIVE);
+	b.diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&b.diffopt);
+	b.old = cgit_open_path_bloom();
+	b.graph = cgit_open_commit_graph();
+	for_each_ref(bloom_ref_cb, &b);
+	collect_commits(&b);
+	err = write_filters(&b, fd);
+	if (close(fd) && !err)
+		err = errno;
+	cgit_close_commit_graph(b.graph);
+	cgit_close_path_bloom(b.old);
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	free(b.commits);
+	free(b.end);
+	strbuf_release(&b.data);
+	free(lock);
+	free(path);
+	return err;
+}
@@ -0,0 +1,24 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "cgit.h"
+
+struct path_bloom;
+
+/* Open the changed-path filters for the current repository, NULL if
+ * unavailable.
+ */
+extern struct path_bloom *cgit_open_path_bloom(void);
+extern void cgit_close_path_bloom(struct path_bloom *bloom);
+
+/* Check if the commit `sha1` may have changed `path` (or anything below
+ * it) compared to its first parent. Return 0 if it definitely did not,
+ * 1 if it might have and -1 if the commit has no filter.
+ */
+extern int cgit_path_bloom_check(struct path_bloom *bloom,
+				 const unsigned char *sha1, const char *path);
+
+/* (Re)generate the changed-path filters for the current repository */
+extern int cgit_write_path_bloom(void);
+
+#endif /* BLOOM_H */
@@ -10,6 +10,12 @@
 #include "cgit.h"
 #include "cache.h"
 #include "cmd.h"
+#include "commit-index.h"
+#include "commit-graph.h"
+#include "bloom.h"
+#include "diffstat.h"
+#include "stats-cube.h"
+#include "snapshot-cache.h"
 #include "configfile.h"
 #include "html.h"
 #include "ui-shared.h"
@@ -63,8 +69,12 @@ void repo_config(struct cgit_repo *repo, const char *name, const char *value)
 		repo->enable_log_linecount = ctx.cfg.enable_log_linecount * atoi(value);
 	else if (!strcmp(name, "enable-remote-branches"))
 		repo->enable_remote_branches = atoi(value);
+	else if (!strcmp(name, "enable-smart-http"))
+		repo->enable_smart_http = ctx.cfg.enable_smart_http * atoi(value);
 	else if (!strcmp(name, "enable-subject-links"))
 		repo->enable_subject_links = atoi(value);
+	else if (!strcmp(name, "enable-tree-lastcommit"))
+		repo->enable_tree_lastcommit = ctx.cfg.enable_tree_lastcommit * atoi(value);
 	else if (!strcmp(name, "max-stats"))
 		repo->max_stats = cgit_find_stats_period(value, NULL);
 	else if (!strcmp(name, "module-link"))
@@ -137,6 +147,8 @@ void config_cb(const char *name, const char *value)
 		ctx.cfg.noheader = atoi(value);
 	else if (!strcmp(name, "snapshots"))
 		ctx.cfg.snapshots = cgit_parse_snapshots_mask(value);
+	else if (!strcmp(name, "snapshot-cache-size"))
+		ctx.cfg.snapshot_cache_size = atoi(value);
 	else if (!strcmp(name, "enable-filter-overrides"))
 		ctx.cfg.enable_filter_overrides = atoi(value);
 	else if (!strcmp(name, "enable-gitweb-owner"))
@@ -149,14 +161,36 @@ void config_cb(const char *name, const char *value)
 		ctx.cfg.enable_log_linecount = atoi(value);
 	else if (!strcmp(name, "enable-remote-branches"))
 		ctx.cfg.enable_remote_branches = atoi(value);
+	else if (!strcmp(name, "enable-smart-http"))
+		ctx.cfg.enable_smart_http = atoi(value);
 	else if (!strcmp(name, "enable-subject-links"))
 		ctx.cfg.enable_subject_links = atoi(value);
 	else if (!strcmp(name, "enable-symlink-traversal"))
 		ctx.cfg.enable_symlink_traversal = atoi(value);
+	else if (!strcmp(name, "enable-tree-lastcommit"))
+		ctx.cfg.enable_tree_lastcommit = atoi(value);
 	else if (!strcmp(name, "enable-tree-linenumbers"))
 		ctx.cfg.enable_tree_linenumbers = atoi(value);
+	else if (!strcmp(name, "diff-buffer-size"))
+		ctx.cfg.diff_buffer_size = atoi(value);
+	else if (!strcmp(name, "intraline-diff"))
+		ctx.cfg.intraline_words = !strcmp(value, "word");
+	else if (!strcmp(name, "max-diff-files"))
+		ctx.cfg.max_diff_files = atoi(value);
+	else if (!strcmp(name, "max-diff-file-size"))
+		ctx.cfg.max_diff_file_size = atoi(value);
+	else if (!strcmp(name, "max-diff-lines"))
+		ctx.cfg.max_diff_lines = atoi(value);
+	else if (!strcmp(name, "max-diff-time"))
+		ctx.cfg.max_diff_time = atoi(value);
+	else if (!strcmp(name, "max-lastcommit-time"))
+		ctx.cfg.max_lastcommit_time = atoi(value);
+	else if (!strcmp(name, "max-ssdiff-cost"))
+		ctx.cfg.max_ssdiff_cost = atoi(value);
 	else if (!strcmp(name, "max-stats"))
 		ctx.cfg.max_stats = cgit_find_stats_period(value, NULL);
+	else if (!strcmp(name, "stats-jobs"))
+		ctx.cfg.stats_jobs = atoi(value);
 	else if (!strcmp(name, "cache-size"))
 		ctx.cfg.cache_size = atoi(value);
 	else if (!strcmp(name, "cache-root"))
@@ -257,6 +291,8 @@ static void querystring_cb(const char *name, const char *value)
 		ctx.qry.has_sha1 = 1;
 	} else if (!strcmp(name, "ofs")) {
 		ctx.qry.ofs = atoi(value);
+	} else if (!strcmp(name, "after")) {
+		ctx.qry.after = xstrdup(value);
 	} else if (!strcmp(name, "path")) {
 		ctx.qry.path = trim_end(value, '/');
 	} else if (!strcmp(name, "name")) {
@@ -277,6 +313,8 @@ static void querystring_cb(const char *name, const char *value)
 		ctx.qry.context = atoi(value);
 	} else if (!strcmp(name, "ignorews")) {
 		ctx.qry.ignorews = atoi(value);
+	} else if (!strcmp(name, "service")) {
+		ctx.qry.service = xstrdup(value);
 	}
 }
 
@@ -310,7 +348,16 @@ static void prepare_context(struct cgit_context *ctx)
 	ctx->cfg.max_msg_len = 80;
 	ctx->cfg.max_repodesc_len = 80;
 	ctx->cfg.max_blob_size = 0;
+	ctx->cfg.diff_buffer_size = 8192;
+	ctx->cfg.max_ssdiff_cost = 1000000;
+	ctx->cfg.max_diff_files = 0;
+	ctx->cfg.max_diff_file_size = 0;
+	ctx->cfg.max_diff_lines = 0;
+	ctx->cfg.max_diff_time = 0;
+	ctx->cfg.max_lastcommit_time = 10;
+	ctx->cfg.snapshot_cache_size = 0;
 	ctx->cfg.max_stats = 0;
+	ctx->cfg.stats_jobs = 1;
 	ctx->cfg.module_link = "./?repo=%s&page=commit&id=%s";
 	ctx->cfg.nofollow_old_commits = 0;
 	ctx->cfg.project_list = NULL;
@@ -327,7 +374,15 @@ static void prepare_context(struct cgit_context *ctx)
 	ctx->cfg.max_atom_items = 10;
 	ctx->cfg.ssdiff = 0;
 	ctx->env.cgit_config = xstrdupn(getenv("CGIT_CONFIG"));
+	ctx->env.content_type = xstrdupn(getenv("CONTENT_TYPE"));
+	ctx->env.http_content_encoding =
+		xstrdupn(getenv("HTTP_CONTENT_ENCODING"));
 	ctx->env.http_host = xstrdupn(getenv("HTTP_HOST"));
+	ctx->env.http_if_modified_since =
+		xstrdupn(getenv("HTTP_IF_MODIFIED_SINCE"));
+	ctx->env.http_if_none_match = xstrdupn(getenv("HTTP_IF_NONE_MATCH"));
+	ctx->env.http_if_range = xstrdupn(getenv("HTTP_IF_RANGE"));
+	ctx->env.http_range = xstrdupn(getenv("HTTP_RANGE"));
 	ctx->env.https = xstrdupn(getenv("HTTPS"));
 	ctx->env.no_http = xstrdupn(getenv("NO_HTTP"));
 	ctx->env.path_info = xstrdupn(getenv("PATH_INFO"));
@@ -476,6 +531,8 @@ static void process_request(void *cbdata)
 
 	if (ctx->repo && prepare_repo_cmd(ctx))
 		return;
+	else if (ctx->repo && cmd->want_etag && cgit_print_not_modified(ctx))
+		return;
 	else if (!cmd->want_repo && !ctx->repo && cmd->want_layout)
 		/* For the root-readme page. */
 		cmd->init(ctx);
@@ -553,6 +610,10 @@ void print_repo(FILE *f, struct cgit_repo *repo)
 	        repo->enable_log_filecount);
 	fprintf(f, "repo.enable-log-linecount=%d\n",
 	        repo->enable_log_linecount);
+	fprintf(f, "repo.enable-smart-http=%d\n",
+	        repo->enable_smart_http);
+	fprintf(f, "repo.enable-tree-lastcommit=%d\n",
+	        repo->enable_tree_lastcommit);
 	if (repo->about_filter && repo->about_filter != ctx.cfg.about_filter)
 		fprintf(f, "repo.about-filter=%s\n", repo->about_filter->cmd);
 	if (repo->commit_filter && repo->commit_filter != ctx.cfg.commit_filter)
@@ -655,6 +716,115 @@ static void process_cached_repolist(const char *path)
 	exit(generate_cached_repolist(path, cached_rc));
 }
 
+/* Offline index generators, selected on the command line */
+#define BUILD_LOG_INDEX    1
+#define BUILD_COMMIT_GRAPH 2
+#define BUILD_PATH_BLOOM   4
+#define BUILD_DIFFSTAT     8
+#define BUILD_STATS        16
+#define BUILD_ALL          (BUILD_LOG_INDEX | BUILD_COMMIT_GRAPH | \
+			    BUILD_PATH_BLOOM | BUILD_DIFFSTAT | BUILD_STATS)
+
+static int build_indexes;
+
+static int report_index(struct cgit_repo *repo, const char *name, int err)
+{
+	if (err)
+		fprintf(stderr, "[cgit] Error writing %s for %s: %s (%d)\n",
+			name, repo->url, strerror(err), err);
+	return err;
+}
+
+static int build_repo_indexes(struct cgit_repo *repo)
+{
+	int nongit = 0, err = 0;
+
+	ctx.repo = repo;
+	setenv("GIT_DIR", repo->path, 1);
+	setup_git_directory_gently(&nongit);
+	if (nongit) {
+		fprintf(stderr, "[cgit] Not a git repository: %s\n",
+			repo->path);
+		return 1;
+	}
+	if (build_indexes & BUILD_COMMIT_GRAPH)
+		err |= report_index(repo, "commit graph",
+				    cgit_write_commit_graph());
+	if (build_indexes & BUILD_PATH_BLOOM)
+		err |= report_index(repo, "changed-path filters",
+				    cgit_write_path_bloom());
+	if ((build_indexes & BUILD_DIFFSTAT) && repo->enable_log_filecount)
+		err |= report_index(repo, "diffstat cache",
+				    cgit_write_diffstats());
+	if ((build_indexes & BUILD_STATS) && repo->max_stats)
+		err |= report_index(repo, "stats cache",
+				    cgit_write_stats_cubes());
+	if (build_indexes & BUILD_LOG_INDEX)
+		err |= report_index(repo, "log index",
+				    cgit_write_commit_index());
+	return err ? 1 : 0;
+}
+
+/* Generate the requested indexes for the repository selected by --repo,
+ * or for every configured repository. Since libgit can only handle one
+ * repository per process, each repository is processed by a child.
+ */
+static int build_all_indexes(void)
+{
+	struct cgit_repo *repo;
+	int i, status, err = 0;
+	pid_t pid;
+
+	for (i = 0; i < cgit_repolist.count; i++) {
+		repo = &cgit_repolist.repos[i];
+		if (!repo->path ||
+		    (ctx.qry.repo && strcmp(ctx.qry.repo, repo->url)))
+			continue;
+		pid = chk_non_negative(fork(), "Unable to create subprocess");
+		if (pid == 0)
+			exit(build_repo_indexes(repo));
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			err = 1;
+	}
+	return err;
+}
+
+static const struct {
+	const char *name;
+	int bit;
+} index_names[] = {
+	{"log", BUILD_LOG_INDEX},
+	{"commit-graph", BUILD_COMMIT_GRAPH},
+	{"path-bloom", BUILD_PATH_BLOOM},
+	{"diffstat", BUILD_DIFFSTAT},
+	{"stats", BUILD_STATS},
+	{NULL, 0}
+};
+
+/* Parse a comma separated list of index names, as given to --build-index */
+static int parse_index_names(const char *str)
+{
+	static const char *delim = " \t,";
+	int i, tl, rv = 0;
+
+	for (;;) {
+		str += strspn(str, delim);
+		tl = strcspn(str, delim);
+		if (!tl)
+			break;
+		for (i = 0; index_names[i].name; i++)
+			if (strlen(index_names[i].name) == tl &&
+			    !strncmp(index_names[i].name, str, tl))
+				break;
+		if (!index_names[i].name)
+			die("Unknown index: %.*s", tl, str);
+		rv |= index_names[i].bit;
+		str += tl;
+	}
+	return rv;
+}
+
 static void cgit_parse_args(int argc, const char **argv)
 {
 	int i;
@@ -690,6 +860,12 @@ static void cgit_parse_args(int argc, const char **argv)
 		if (!strncmp(argv[i], "--ofs=", 6)) {
 			ctx.qry.ofs = atoi(argv[i]+6);
 		}
+		if (!strcmp(argv[i], "--build-index")) {
+			build_indexes |= BUILD_ALL;
+		}
+		if (!strncmp(argv[i], "--build-index=", 14)) {
+			build_indexes |= parse_index_names(argv[i] + 14);
+		}
 		if (!strncmp(argv[i], "--scan-tree=", 12) ||
 		    !strncmp(argv[i], "--scan-path=", 12)) {
 			/* HACK: the global snapshot bitmask defines the
@@ -736,6 +912,7 @@ int main(int argc, const char **argv)
 	const char *path;
 	char *qry;
 	int err, ttl;
+	struct cgit_cmd *cmd;
 
 	prepare_context(&ctx);
 	cgit_repolist.length = 0;
@@ -744,6 +921,8 @@ int main(int argc, const char **argv)
 
 	cgit_parse_args(argc, argv);
 	parse_configfile(expand_macros(ctx.env.cgit_config), config_cb);
+	if (build_indexes)
+		return build_all_indexes();
 	ctx.repo = NULL;
 	http_parse_querystring(ctx.qry.raw, querystring_cb);
 
@@ -776,6 +955,22 @@ int main(int argc, const char **argv)
 	ctx.page.expires += ttl*60;
 	if (ctx.env.request_method && !strcmp(ctx.env.request_method, "HEAD"))
 		ctx.cfg.nocache = 1;
+	/* The smart http protocol talks to upload-pack on every request */
+	if (ctx.qry.service ||
+	    (ctx.env.request_method && !strcmp(ctx.env.request_method, "POST")))
+		ctx.cfg.nocache = 1;
+	/* Partial responses must not be served for later full requests */
+	if (ctx.env.http_range)
+		ctx.cfg.nocache = 1;
+	/* Nor must a 304 response be, for pages which may send one */
+	cmd = cgit_get_cmd(&ctx);
+	if (cmd && cmd->want_etag && (ctx.env.http_if_none_match ||
+				      ctx.env.http_if_modified_since))
+		ctx.cfg.nocache = 1;
+	/* Snapshots saved by the snapshot cache need no second copy */
+	if (cmd && !strcmp(cmd->name, "snapshot") &&
+	    cgit_snapshot_cache_enabled())
+		ctx.cfg.nocache = 1;
 	if (ctx.cfg.nocache)
 		ctx.cfg.cache_size = 0;
 	err = cache_process(ctx.cfg.cache_size, ctx.cfg.cache_root,
@@ -74,7 +74,9 @@ struct cgit_repo {
 	int enable_log_filecount;
 	int enable_log_linecount;
 	int enable_remote_branches;
+	int enable_smart_http;
 	int enable_subject_links;
+	int enable_tree_lastcommit;
 	int max_stats;
 	time_t mtime;
 	struct cgit_filter *about_filter;
@@ -143,6 +145,7 @@ struct cgit_query {
 	char *url;
 	char *period;
 	int   ofs;
+	char *after;
 	int nohead;
 	char *sort;
 	int showmsg;
@@ -151,6 +154,7 @@ struct cgit_query {
 	int context;
 	int ignorews;
 	char *vpath;
+	char *service;
 };
 
 struct cgit_config {
@@ -182,6 +186,7 @@ struct cgit_config {
 	int cache_root_ttl;
 	int cache_scanrc_ttl;
 	int cache_static_ttl;
+	int diff_buffer_size;
 	int embedded;
 	int enable_filter_overrides;
 	int enable_gitweb_owner;
@@ -189,9 +194,12 @@ struct cgit_config {
 	int enable_log_filecount;
 	int enable_log_linecount;
 	int enable_remote_branches;
+	int enable_smart_http;
 	int enable_subject_links;
 	int enable_symlink_traversal;
+	int enable_tree_lastcommit;
 	int enable_tree_linenumbers;
+	int intraline_words;
 	int local_time;
 	int max_atom_items;
 	int max_repo_count;
@@ -200,13 +208,21 @@ struct cgit_config {
 	int max_msg_len;
 	int max_repodesc_len;
 	int max_blob_size;
+	int max_diff_files;
+	int max_diff_file_size;
+	int max_diff_lines;
+	int max_diff_time;
+	int max_lastcommit_time;
+	int max_ssdiff_cost;
 	int max_stats;
+	int stats_jobs;
 	int nocache;
 	int nofollow_old_commits;
 	int noplainemail;
 	int noheader;
 	int renamelimit;
 	int remove_suffix;
+	int snapshot_cache_size;
 	int snapshots;
 	int summary_branches;
 	int summary_log;
@@ -229,11 +245,19 @@ struct cgit_page {
 	char *title;
 	int status;
 	char *statusmsg;
+	int accept_ranges;
+	char *content_range;
 };
 
 struct cgit_environment {
 	char *cgit_config;
+	char *content_type;
+	char *http_content_encoding;
 	char *http_host;
+	char *http_if_modified_since;
+	char *http_if_none_match;
+	char *http_if_range;
+	char *http_range;
 	char *https;
 	char *no_http;
 	char *path_info;
@@ -289,6 +313,12 @@ extern int cgit_diff_files(const unsigned char *old_sha1,
 			   int *binary, int context, int ignorews,
 			   linediff_fn fn);
 
+extern int cgit_diff_files_count(const unsigned char *old_sha1,
+				 const unsigned char *new_sha1,
+				 unsigned long *old_size,
+				 unsigned long *new_size, int *binary,
+				 int ignorews, int *added, int *removed);
+
 extern void cgit_diff_tree(const unsigned char *old_sha1,
 			   const unsigned char *new_sha1,
 			   filepair_fn fn, const char *prefix, int ignorews);
@@ -298,6 +328,8 @@ extern void cgit_diff_commit(struct commit *commit, filepair_fn fn);
 extern char *fmt(const char *format,...);
 
 extern struct commitinfo *cgit_parse_commit(struct commit *commit);
+extern struct commitinfo *cgit_parse_commit_fields(struct commit *commit,
+						   int fields);
 extern struct taginfo *cgit_parse_tag(struct tag *tag);
 extern void cgit_parse_url(const char *url);
 
@@ -309,6 +341,10 @@ extern int cgit_open_filter(struct cgit_filter *filter);
 extern int cgit_close_filter(struct cgit_filter *filter);
 
 extern int readfile(const char *path, char **buf, size_t *size);
+extern int cgit_sendfile(int fd, int src, unsigned long ofs,
+			 unsigned long len);
+extern int cgit_open_lock(const char *lock);
+extern void cgit_evict_cache_files(const char *prefix, off_t budget);
 
 extern char *expand_macros(const char *txt);
 
@@ -319,4 +355,13 @@ extern int cgit_find_object_by_path(const unsigned char *sha1_root,
 
 #define FOLLOW_SYMLINKS 1
 
+/*
+ * Fields copied by cgit_parse_commit_fields()
+ */
+#define COMMIT_PARSE_AUTHOR	0x01
+#define COMMIT_PARSE_COMMITTER	0x02
+#define COMMIT_PARSE_SUBJECT	0x04
+#define COMMIT_PARSE_MSG	0x08
+#define COMMIT_PARSE_ALL	0x0f
+
 #endif /* CGIT_H */
@@ -77,6 +77,7 @@ static void commit_fn(struct cgit_context *ctx)
 static void commit_init(struct cgit_context *ctx)
 {
 	cgit_init_commit(ctx, ctx->qry.sha1);
+	cgit_commit_etag(ctx, ctx->qry.sha1, NULL);
 }
 
 static void diff_fn(struct cgit_context *ctx)
@@ -85,6 +86,17 @@ static void diff_fn(struct cgit_context *ctx)
 }
 
 static void diff_init(struct cgit_context *ctx)
+{
+	cgit_generic_title(ctx);
+	cgit_commit_etag(ctx, ctx->qry.sha1, ctx->qry.sha2);
+}
+
+static void upload_pack_fn(struct cgit_context *ctx)
+{
+	cgit_clone_upload_pack(ctx);
+}
+
+static void upload_pack_init(struct cgit_context *ctx)
 {
 	cgit_generic_title(ctx);
 }
@@ -151,6 +163,7 @@ static void patch_fn(struct cgit_context *ctx)
 static void patch_init(struct cgit_context *ctx)
 {
 	cgit_generic_title(ctx);
+	cgit_commit_etag(ctx, ctx->qry.sha1, NULL);
 }
 
 static void plain_fn(struct cgit_context *ctx)
@@ -222,33 +235,36 @@ static void tree_fn(struct cgit_context *ctx)
 static void tree_init(struct cgit_context *ctx)
 {
 	cgit_generic_title(ctx);
+	cgit_commit_etag(ctx, ctx->qry.sha1, NULL);
 }
 
-#define def_cmd(name, want_repo, want_layout, want_vpath) \
-	{#name, name##_fn, name##_init, want_repo, want_layout, want_vpath}
+#define def_cmd(name, want_repo, want_layout, want_vpath, want_etag) \
+	{#name, name##_fn, name##_init, want_repo, want_layout, want_vpath, \
+	 want_etag}
 
 struct cgit_cmd *cgit_get_cmd(struct cgit_context *ctx)
 {
 	static struct cgit_cmd cmds[] = {
-		def_cmd(HEAD, 1, 0, 0),
-		def_cmd(atom, 1, 0, 0),
-		def_cmd(about, 0, 1, 0),
-		def_cmd(blob, 1, 0, 0),
-		def_cmd(commit, 1, 1, 1),
-		def_cmd(diff, 1, 1, 1),
-		def_cmd(info, 1, 0, 0),
-		def_cmd(log, 1, 1, 1),
-		def_cmd(ls_cache, 0, 0, 0),
-		def_cmd(objects, 1, 0, 0),
-		def_cmd(patch, 1, 0, 1),
-		def_cmd(plain, 1, 0, 0),
-		def_cmd(refs, 1, 1, 0),
-		def_cmd(repolist, 0, 0, 0),
-		def_cmd(snapshot, 1, 0, 0),
-		def_cmd(stats, 1, 1, 1),
-		def_cmd(summary, 1, 1, 0),
-		def_cmd(tag, 1, 1, 0),
-		def_cmd(tree, 1, 1, 1),
+		def_cmd(HEAD, 1, 0, 0, 0),
+		def_cmd(atom, 1, 0, 0, 0),
+		def_cmd(about, 0, 1, 0, 0),
+		def_cmd(blob, 1, 0, 0, 1),
+		def_cmd(commit, 1, 1, 1, 1),
+		def_cmd(diff, 1, 1, 1, 1),
+		{"git-upload-pack", upload_pack_fn, upload_pack_init, 1, 0, 0, 0},
+		def_cmd(info, 1, 0, 0, 0),
+		def_cmd(log, 1, 1, 1, 0),
+		def_cmd(ls_cache, 0, 0, 0, 0),
+		def_cmd(objects, 1, 0, 0, 0),
+		def_cmd(patch, 1, 0, 1, 1),
+		def_cmd(plain, 1, 0, 0, 1),
+		def_cmd(refs, 1, 1, 0, 0),
+		def_cmd(repolist, 0, 0, 0, 0),
+		def_cmd(snapshot, 1, 0, 0, 0),
+		def_cmd(stats, 1, 1, 1, 0),
+		def_cmd(summary, 1, 1, 0, 0),
+		def_cmd(tag, 1, 1, 0, 0),
+		def_cmd(tree, 1, 1, 1, 1),
 	};
 	int i;
 
@@ -9,7 +9,8 @@ struct cgit_cmd {
 	cgit_cmd_fn init;
 	unsigned int want_repo:1,
 		want_layout:1,
-		want_vpath:1;
+		want_vpath:1,
+		want_etag:1;
 };
 
 extern struct cgit_cmd *cgit_get_cmd(struct cgit_context *ctx);
@@ -0,0 +1,747 @@
+/* commit-graph.c: precomputed commit DAG for revision walks
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The commit graph is a sidecar file stored in the repository, generated
+ * by `cgit --build-index`. It holds a fixed-width record for every commit
+ * reachable from any ref, so that walks over the history can learn the
+ * parents, commit date and root tree of a commit without inflating it.
+ * Commits created after the graph was written are parsed as usual.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       4 x uint32: magic, version, commits, extra edges
+ *   fanout       256 x uint32: number of commits with a first sha1 byte
+ *                less than or equal to the index
+ *   sha1         one 20-byte sha1 per commit, sorted
+ *   records      per commit: root tree sha1, two parent positions, commit
+ *                date (high and low 32 bits) and generation number
+ *   extra edges  parent positions for octopus merges
+ *
+ * A commit without parents has both parent positions set to
+ * GRAPH_NO_PARENT. For a merge with more than two parents, the second
+ * position has GRAPH_EXTRA_EDGES set and points into the extra edges,
+ * where the last parent is marked with GRAPH_LAST_EDGE.
+ *
+ * The generation number of a root commit is 1, for any other commit it
+ * is one more than the largest generation number of its parents.
+ */
+
+#include "cgit.h"
+#include "commit-graph.h"
+#include "bloom.h"
+
+#define GRAPH_MAGIC       0x43475246 /* "CGRF" */
+#define GRAPH_VERSION     1
+#define GRAPH_FILE        "info/cgit/commit-graph"
+#define GRAPH_NO_PARENT   0xffffffff
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define GRAPH_LAST_EDGE   0x80000000
+
+struct graph_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_commits;
+	uint32_t nr_extra;
+};
+
+struct graph_record {
+	unsigned char tree[20];
+	uint32_t parent[2];
+	uint32_t date_high;
+	uint32_t date_low;
+	uint32_t generation;
+};
+
+struct commit_graph {
+	void *map;
+	size_t size;
+	uint32_t nr_commits;
+	uint32_t nr_extra;
+	const uint32_t *fanout;
+	const unsigned char *sha1;
+	const struct graph_record *records;
+	const uint32_t *extra;
+};
+
+struct graph_walk_entry {
+	struct commit *commit;
+	uint32_t generation;
+};
+
+struct commit_graph *cgit_open_commit_graph(void)
+{
+	struct commit_graph *graph;
+	const struct graph_header *hdr;
+	struct stat st;
+	uint64_t expected;
+	uint32_t i;
+	int fd;
+
+	fd = open(git_path(GRAPH_FILE), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	graph = xcalloc(1, sizeof(*graph));
+	graph->size = st.st_size;
+	graph->map = mmap(NULL, graph->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (graph->map == MAP_FAILED) {
+		free(graph);
+		return NULL;
+	}
+	hdr = graph->map;
+	graph->nr_commits = ntohl(hdr->nr_commits);
+	graph->nr_extra = ntohl(hdr->nr_extra);
+	expected = sizeof(*hdr) + 256 * sizeof(uint32_t) +
+		(uint64_t)graph->nr_commits *
+			(20 + sizeof(struct graph_record)) +
+		(uint64_t)graph->nr_extra * sizeof(uint32_t);
+	if (ntohl(hdr->magic) != GRAPH_MAGIC ||
+	    ntohl(hdr->version) != GRAPH_VERSION ||
+	    graph->nr_commits >= GRAPH_EXTRA_EDGES ||
+	    expected != graph->size) {
+		cgit_close_commit_graph(graph);
+		return NULL;
+	}
+	graph->fanout = (const uint32_t *)(hdr + 1);
+	graph->sha1 = (const unsigned char *)(graph->fanout + 256);
+	graph->records = (const struct graph_record *)
+		(graph->sha1 + 20 * graph->nr_commits);
+	graph->extra = (const uint32_t *)(graph->records + graph->nr_commits);
+
+	for (i = 1; i < 256; i++)
+		if (ntohl(graph->fanout[i]) < ntohl(graph->fanout[i - 1]))
+			break;
+	if (i < 256 || ntohl(graph->fanout[255]) != graph->nr_commits) {
+		cgit_close_commit_graph(graph);
+		return NULL;
+	}
+	return graph;
+}
+
+void cgit_close_commit_graph(struct commit_graph *graph)
+{
+	if (!graph)
+		return;
+	munmap(graph->map, graph->size);
+	free(graph);
+}
+
+static int graph_pos(struct commit_graph *graph, const unsigned char *sha1,
+		     uint32_t *pos)
+{
+	uint32_t lo, hi, mid;
+	int cmp;
+
+	lo = sha1[0] ? ntohl(graph->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(graph->fanout[sha1[0]]);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = hashcmp(graph->sha1 + 20 * mid, sha1);
+		if (!cmp) {
+			*pos = mid;
+			return 0;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+/* Make sure all parent positions of a record are within bounds */
+static int check_parents(struct commit_graph *graph,
+			 const struct graph_record *rec)
+{
+	uint32_t parent, edge;
+
+	parent = ntohl(rec->parent[0]);
+	if (parent != GRAPH_NO_PARENT && parent >= graph->nr_commits)
+		return -1;
+	parent = ntohl(rec->parent[1]);
+	if (parent == GRAPH_NO_PARENT)
+		return 0;
+	if (!(parent & GRAPH_EXTRA_EDGES))
+		return parent < graph->nr_commits ? 0 : -1;
+	edge = parent & ~GRAPH_EXTRA_EDGES;
+	do {
+		if (edge >= graph->nr_extra)
+			return -1;
+		parent = ntohl(graph->extra[edge++]);
+		if ((parent & ~GRAPH_LAST_EDGE) >= graph->nr_commits)
+			return -1;
+	} while (!(parent & GRAPH_LAST_EDGE));
+	return 0;
+}
+
+static struct commit_list **add_parent(struct commit_graph *graph,
+				       uint32_t pos, struct commit_list **pptr)
+{
+	struct commit *parent;
+
+	parent = lookup_commit(graph->sha1 + 20 * pos);
+	return &commit_list_insert(parent, pptr)->next;
+}
+
+int cgit_commit_graph_fill(struct commit_graph *graph, struct commit *commit,
+			   uint32_t *generation)
+{
+	const struct graph_record *rec;
+	struct commit_list **pptr;
+	uint32_t pos, parent, edge;
+
+	if (!graph || graph_pos(graph, commit->object.sha1, &pos))
+		return -1;
+	rec = graph->records + pos;
+	if (commit->object.parsed)
+		goto out;
+	if (check_parents(graph, rec))
+		return -1;
+
+	commit->object.parsed = 1;
+	commit->date = ((uint64_t)ntohl(rec->date_high) << 32) |
+		ntohl(rec->date_low);
+	commit->tree = lookup_tree(rec->tree);
+	pptr = &commit->parents;
+	parent = ntohl(rec->parent[0]);
+	if (parent != GRAPH_NO_PARENT)
+		pptr = add_parent(graph, parent, pptr);
+	parent = ntohl(rec->parent[1]);
+	if (parent == GRAPH_NO_PARENT)
+		goto out;
+	if (!(parent & GRAPH_EXTRA_EDGES)) {
+		add_parent(graph, parent, pptr);
+		goto out;
+	}
+	edge = parent & ~GRAPH_EXTRA_EDGES;
+	do {
+		parent = ntohl(graph->extra[edge++]);
+		pptr = add_parent(graph, parent & ~GRAPH_LAST_EDGE, pptr);
+	} while (!(parent & GRAPH_LAST_EDGE));
+out:
+	if (generation)
+		*generation = ntohl(rec->generation);
+	return 0;
+}
+
+void cgit_graph_walk_init(struct graph_walk *walk, struct commit_graph *graph)
+{
+	memset(walk, 0, sizeof(*walk));
+	walk->graph = graph;
+	walk->min_generation = GENERATION_INFINITY;
+}
+
+void cgit_graph_walk_set_path(struct graph_walk *walk, const char *path,
+			      struct path_bloom *bloom)
+{
+	static const char *paths[2];
+
+	paths[0] = walk->path = path;
+	walk->bloom = bloom;
+	diff_setup(&walk->diffopt);
+	DIFF_OPT_SET(&walk->diffopt, RECURSIVE);
+	DIFF_OPT_SET(&walk->diffopt, QUICK);
+	walk->diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_tree_setup_paths(paths, &walk->diffopt);
+	diff_setup_done(&walk->diffopt);
+}
+
+static int fill_commit(struct graph_walk *walk, struct commit *commit,
+		       uint32_t *generation)
+{
+	if (!cgit_commit_graph_fill(walk->graph, commit, generation))
+		return 0;
+	if (parse_commit(commit) || !commit->tree)
+		return -1;
+	if (generation)
+		*generation = GENERATION_INFINITY;
+	return 0;
+}
+
+/* Check if `path` differs between the trees, `old` may be NULL */
+static int path_changed(struct graph_walk *walk, struct tree *old,
+			struct tree *new)
+{
+	int changed;
+
+	DIFF_OPT_CLR(&walk->diffopt, HAS_CHANGES);
+	if (old)
+		diff_tree_sha1(old->object.sha1, new->object.sha1, "",
+			       &walk->diffopt);
+	else
+		diff_root_tree_sha1(new->object.sha1, "", &walk->diffopt);
+	changed = DIFF_OPT_TST(&walk->diffopt, HAS_CHANGES);
+	diff_flush(&walk->diffopt);
+	return changed;
+}
+
+/* Simplify history like try_to_simplify_commit() in revision.c: if the
+ * commit does not change the path compared to one of its parents, only
+ * that parent is kept and the commit is hidden. Return 1 if hidden.
+ */
+static int simplify_commit(struct graph_walk *walk, struct commit *commit)
+{
+	struct commit_list *p;
+	struct commit *parent;
+	int same;
+
+	if (!commit->parents)
+		return !path_changed(walk, NULL, commit->tree);
+	for (p = commit->parents; p; p = p->next) {
+		parent = p->item;
+		if (fill_commit(walk, parent, NULL))
+			continue;
+		if (p == commit->parents &&
+		    !cgit_path_bloom_check(walk->bloom, commit->object.sha1,
+					   walk->path))
+			same = 1;
+		else
+			same = !path_changed(walk, parent->tree, commit->tree);
+		if (!same)
+			continue;
+		free_commit_list(commit->parents);
+		commit->parents = NULL;
+		commit_list_insert(parent, &commit->parents);
+		return 1;
+	}
+	return 0;
+}
+
+/* Order commits by date, like insert_by_date() does, but let commits
+ * with a higher generation number go first when the dates are equal, and
+ * use the sha1 as a final tie-breaker to make the order stable.
+ */
+static int walk_cmp(const struct graph_walk_entry *a,
+		    const struct graph_walk_entry *b)
+{
+	if (a->commit->date != b->commit->date)
+		return a->commit->date > b->commit->date ? -1 : 1;
+	if (a->generation != b->generation)
+		return a->generation > b->generation ? -1 : 1;
+	return hashcmp(a->commit->object.sha1, b->commit->object.sha1);
+}
+
+static void queue_swap(struct graph_walk_entry *queue, int i, int j)
+{
+	struct graph_walk_entry tmp = queue[i];
+
+	queue[i] = queue[j];
+	queue[j] = tmp;
+}
+
+/* The queue is a binary heap with the next commit of the walk on top */
+static void walk_add(struct graph_walk *walk, struct commit *commit)
+{
+	struct graph_walk_entry *queue;
+	uint32_t generation;
+	int i, parent;
+
+	if (commit->object.flags & SEEN)
+		return;
+	commit->object.flags |= SEEN;
+	if (fill_commit(walk, commit, &generation))
+		return;
+	ALLOC_GROW(walk->queue, walk->queue_nr + 1, walk->queue_alloc);
+	queue = walk->queue;
+	i = walk->queue_nr++;
+	queue[i].commit = commit;
+	queue[i].generation = generation;
+	while (i) {
+		parent = (i - 1) / 2;
+		if (walk_cmp(&queue[i], &queue[parent]) >= 0)
+			break;
+		queue_swap(queue, i, parent);
+		i = parent;
+	}
+}
+
+/* Remove the next commit of the walk from the queue, NULL if empty */
+static struct commit *walk_pop(struct graph_walk *walk, uint32_t *generation)
+{
+	struct graph_walk_entry *queue = walk->queue;
+	struct commit *commit;
+	int i = 0, child;
+
+	if (!walk->queue_nr)
+		return NULL;
+	commit = queue[0].commit;
+	*generation = queue[0].generation;
+	queue[0] = queue[--walk->queue_nr];
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= walk->queue_nr)
+			break;
+		if (child + 1 < walk->queue_nr &&
+		    walk_cmp(&queue[child + 1], &queue[child]) < 0)
+			child++;
+		if (walk_cmp(&queue[child], &queue[i]) >= 0)
+			break;
+		queue_swap(queue, i, child);
+		i = child;
+	}
+	return commit;
+}
+
+static int graph_walk_start(struct graph_walk *walk, const char *rev)
+{
+	unsigned char sha1[20];
+	struct commit *commit;
+
+	if (get_sha1(rev, sha1))
+		return -1;
+	commit = lookup_commit_reference_gently(sha1, 1);
+	if (!commit)
+		return -1;
+	walk_add(walk, commit);
+	return 0;
+}
+
+/* Return the next commit in date order. Like a revision walk with
+ * --since, commits older than `since` are skipped and their parents are
+ * not visited.
+ */
+struct commit *cgit_graph_walk_next(struct graph_walk *walk)
+{
+	struct commit_list *p;
+	struct commit *commit;
+	uint32_t generation;
+	int hidden;
+
+	while ((commit = walk_pop(walk, &generation)) != NULL) {
+		if (generation < walk->min_generation)
+			walk->min_generation = generation;
+		if (walk->since && commit->date < walk->since)
+			continue;
+		hidden = walk->path && simplify_commit(walk, commit);
+		for (p = commit->parents; p; p = p->next)
+			walk_add(walk, p->item);
+		if (hidden)
+			continue;
+		if (walk->no_merges && commit->parents &&
+		    commit->parents->next)
+			continue;
+		return commit;
+	}
+	return NULL;
+}
+
+/* Return -1 if there is no commit graph, the revision walk is used then */
+static int walk_prepare(struct graph_walk *walk, const char *path)
+{
+	cgit_graph_walk_init(walk, cgit_open_commit_graph());
+	if (!walk->graph)
+		return -1;
+	if (path)
+		cgit_graph_walk_set_path(walk, path, cgit_open_path_bloom());
+	return 0;
+}
+
+/* Prepare a walk from `rev`, limited to `path` unless it is NULL. Return
+ * 0 on success, or -1 if `rev` is not a commit or there is no commit
+ * graph.
+ */
+int cgit_graph_walk_setup(struct graph_walk *walk, const char *rev,
+			  const char *path)
+{
+	if (walk_prepare(walk, path))
+		return -1;
+	if (!graph_walk_start(walk, rev))
+		return 0;
+	cgit_graph_walk_release(walk);
+	return -1;
+}
+
+/* Describe the commits still queued, i.e. where the walk would continue,
+ * as comma separated sha1s. Return -1 if nothing or more than `max`
+ * commits are queued.
+ *
+ * A walk resumed from the cursor no longer knows which commits were seen,
+ * so the cursor is only valid if no commit returned so far can be reached
+ * from the queue again. That holds when every queued commit has a
+ * generation number no larger than those of the returned commits; clock
+ * skew can break it, and the caller has to fall back to an offset then.
+ */
+int cgit_graph_walk_cursor(struct graph_walk *walk, struct strbuf *cursor,
+			   int max)
+{
+	int i;
+
+	if (!walk->queue_nr || walk->queue_nr > max)
+		return -1;
+	for (i = 0; i < walk->queue_nr; i++)
+		if (walk->queue[i].generation == GENERATION_INFINITY ||
+		    walk->queue[i].generation > walk->min_generation)
+			return -1;
+	for (i = 0; i < walk->queue_nr; i++) {
+		if (cursor->len)
+			strbuf_addch(cursor, ',');
+		strbuf_addstr(cursor,
+			      sha1_to_hex(walk->queue[i].commit->object.sha1));
+	}
+	return 0;
+}
+
+/* Prepare a walk continuing from a cursor made by cgit_graph_walk_cursor().
+ * Return 0 on success, or -1 if the cursor is invalid.
+ */
+int cgit_graph_walk_resume(struct graph_walk *walk, const char *cursor,
+			   const char *path)
+{
+	unsigned char sha1[20];
+	struct commit *commit;
+
+	if (walk_prepare(walk, path))
+		return -1;
+	while (*cursor) {
+		if (get_sha1_hex(cursor, sha1) ||
+		    (cursor[40] && cursor[40] != ','))
+			goto fail;
+		commit = lookup_commit_reference_gently(sha1, 1);
+		if (!commit)
+			goto fail;
+		walk_add(walk, commit);
+		cursor += 40;
+		if (*cursor)
+			cursor++;
+	}
+	if (walk->queue_nr)
+		return 0;
+fail:
+	cgit_graph_walk_release(walk);
+	return -1;
+}
+
+void cgit_graph_walk_release(struct graph_walk *walk)
+{
+	free(walk->queue);
+	walk->queue = NULL;
+	walk->queue_nr = walk->queue_alloc = 0;
+	cgit_close_commit_graph(walk->graph);
+	cgit_close_path_bloom(walk->bloom);
+	walk->graph = NULL;
+	walk->bloom = NULL;
+}
+
+struct graph_builder {
+	struct commit_graph *old;
+	struct commit_list *stack;
+	struct commit **commits;
+	int commits_nr;
+	int commits_alloc;
+	uint32_t *generation;
+	struct graph_record *records;
+	uint32_t *extra;
+	int extra_nr;
+	int extra_alloc;
+};
+
+#define builder_pos(commit) ((uint32_t)(uintptr_t)(commit)->util - 1)
+
+static void push_commit(struct graph_builder *b, struct commit *commit)
+{
+	if (commit->object.flags & SEEN)
+		return;
+	commit->object.flags |= SEEN;
+	commit_list_insert(commit, &b->stack);
+}
+
+static int graph_ref_cb(const char *refname, const unsigned char *sha1,
+			int flags, void *cb_data)
+{
+	struct commit *commit;
+
+	commit = lookup_commit_reference_gently(sha1, 1);
+	if (commit)
+		push_commit(cb_data, commit);
+	return 0;
+}
+
+/* Find all commits reachable from the refs. Commits which are in the
+ * previous graph are taken from it instead of being parsed.
+ */
+static void collect_commits(struct graph_builder *b)
+{
+	struct commit *commit;
+	struct commit_list *p;
+
+	while (b->stack) {
+		commit = pop_commit(&b->stack);
+		if (cgit_commit_graph_fill(b->old, commit, NULL) &&
+		    parse_commit(commit))
+			die("Unable to parse commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		if (!commit->tree)
+			die("Missing tree in commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		free(commit->buffer);
+		commit->buffer = NULL;
+		ALLOC_GROW(b->commits, b->commits_nr + 1, b->commits_alloc);
+		b->commits[b->commits_nr++] = commit;
+		for (p = commit->parents; p; p = p->next)
+			push_commit(b, p->item);
+	}
+}
+
+static int cmp_commit_sha1(const void *a, const void *b)
+{
+	const struct commit *c1 = *(const struct commit **)a;
+	const struct commit *c2 = *(const struct commit **)b;
+
+	return hashcmp(c1->object.sha1, c2->object.sha1);
+}
+
+/* Assign generation numbers without recursion: a commit stays on the
+ * stack until the generation numbers of all its parents are known.
+ */
+static void compute_generations(struct graph_builder *b)
+{
+	struct commit_list *stack = NULL, *p;
+	struct commit *commit;
+	uint32_t max, pos;
+	int i, pending;
+
+	for (i = 0; i < b->commits_nr; i++) {
+		if (b->generation[i])
+			continue;
+		commit_list_insert(b->commits[i], &stack);
+		while (stack) {
+			commit = stack->item;
+			if (b->generation[builder_pos(commit)]) {
+				pop_commit(&stack);
+				continue;
+			}
+			max = 0;
+			pending = 0;
+			for (p = commit->parents; p; p = p->next) {
+				pos = builder_pos(p->item);
+				if (!b->generation[pos]) {
+					commit_list_insert(p->item, &stack);
+					pending = 1;
+				} else if (b->generation[pos] > max)
+					max = b->generation[pos];
+			}
+			if (pending)
+				continue;
+			if (max < GENERATION_INFINITY - 1)
+				max++;
+			b->generation[builder_pos(commit)] = max;
+			pop_commit(&stack);
+		}
+	}
+}
+
+static void add_extra_edge(struct graph_builder *b, uint32_t edge)
+{
+	ALLOC_GROW(b->extra, b->extra_nr + 1, b->extra_alloc);
+	b->extra[b->extra_nr++] = htonl(edge);
+}
+
+static void fill_record(struct graph_builder *b, int i)
+{
+	struct graph_record *rec = &b->records[i];
+	struct commit *commit = b->commits[i];
+	struct commit_list *p = commit->parents;
+	uint64_t date = commit->date;
+
+	hashcpy(rec->tree, commit->tree->object.sha1);
+	rec->parent[0] = htonl(p ? builder_pos(p->item) : GRAPH_NO_PARENT);
+	if (!p || !p->next)
+		rec->parent[1] = htonl(GRAPH_NO_PARENT);
+	else if (!p->next->next)
+		rec->parent[1] = htonl(builder_pos(p->next->item));
+	else {
+		rec->parent[1] = htonl(GRAPH_EXTRA_EDGES | b->extra_nr);
+		for (p = p->next; p; p = p->next)
+			add_extra_edge(b, builder_pos(p->item) |
+				       (p->next ? 0 : GRAPH_LAST_EDGE));
+	}
+	rec->date_high = htonl(date >> 32);
+	rec->date_low = htonl(date & 0xffffffff);
+	rec->generation = htonl(b->generation[i]);
+}
+
+static int write_graph(struct graph_builder *b, int fd)
+{
+	struct graph_header hdr;
+	uint32_t fanout[256];
+	int i, j;
+
+	qsort(b->commits, b->commits_nr, sizeof(*b->commits),
+	      cmp_commit_sha1);
+	for (i = 0; i < b->commits_nr; i++)
+		b->commits[i]->util = (void *)(uintptr_t)(i + 1);
+	b->generation = xcalloc(b->commits_nr + 1, sizeof(uint32_t));
+	compute_generations(b);
+	b->records = xcalloc(b->commits_nr + 1, sizeof(*b->records));
+	for (i = 0; i < b->commits_nr; i++)
+		fill_record(b, i);
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < b->commits_nr &&
+		       b->commits[j]->object.sha1[0] <= i)
+			j++;
+		fanout[i] = htonl(j);
+	}
+
+	hdr.magic = htonl(GRAPH_MAGIC);
+	hdr.version = htonl(GRAPH_VERSION);
+	hdr.nr_commits = htonl(b->commits_nr);
+	hdr.nr_extra = htonl(b->extra_nr);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, fanout, sizeof(fanout)) < 0)
+		return errno;
+	for (i = 0; i < b->commits_nr; i++)
+		if (write_in_full(fd, b->commits[i]->object.sha1, 20) < 0)
+			return errno;
+	if (write_in_full(fd, b->records,
+			  b->commits_nr * sizeof(*b->records)) < 0 ||
+	    write_in_full(fd, b->extra, b->extra_nr * sizeof(uint32_t)) < 0)
+		return errno;
+	return 0;
+}
+
+/* Generate the commit graph for all commits reachable from the refs of
+ * the current repository. Return 0 on success and errno otherwise.
+ */
+int cgit_write_commit_graph(void)
+{
+	struct graph_builder b;
+	char *path, *lock;
+	int fd, err;
+
+	path = xstrdup(git_path(GRAPH_FILE));
+	lock = xstrdup(fmt("%s.lock", path));
+	if (safe_create_leading_directories(lock) ||
+	    (fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0) {
+		err = errno ? errno : EINVAL;
+		free(lock);
+		free(path);
+		return err;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.old = cgit_open_commit_graph();
+	for_each_ref(graph_ref_cb, &b);
+	collect_commits(&b);
+	err = write_graph(&b, fd);
+	if (close(fd) && !err)
+		err = errno;
+	cgit_close_commit_graph(b.old);
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	free(b.commits);
+	free(b.generation);
+	free(b.records);
+	free(b.extra);
+	free(lock);
+	free(path);
+	return err;
+}
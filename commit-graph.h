@@ -0,0 +1,62 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "cgit.h"
+
+#define GENERATION_INFINITY 0xffffffff
+
+struct commit_graph;
+
+struct graph_walk_entry;
+
+struct path_bloom;
+
+/* A date ordered walk of the commit DAG which takes parents, dates and
+ * root trees from the commit graph, only parsing commits which are not
+ * in it. If a path is set, history is simplified like a revision walk
+ * limited to that path, using the changed-path filters (if any) to avoid
+ * tree diffs.
+ */
+struct graph_walk {
+	struct commit_graph *graph;
+	struct graph_walk_entry *queue;
+	int queue_nr, queue_alloc;
+	uint32_t min_generation;
+	unsigned long since;
+	int no_merges;
+	const char *path;
+	struct path_bloom *bloom;
+	struct diff_options diffopt;
+};
+
+/* Open the commit graph for the current repository, NULL if unavailable */
+extern struct commit_graph *cgit_open_commit_graph(void);
+extern void cgit_close_commit_graph(struct commit_graph *graph);
+
+/* Fill in the parents, date and tree of `commit` from the graph without
+ * parsing it, and optionally return its generation number. Return 0 if
+ * the commit was found in the graph.
+ */
+extern int cgit_commit_graph_fill(struct commit_graph *graph,
+				  struct commit *commit, uint32_t *generation);
+
+extern void cgit_graph_walk_init(struct graph_walk *walk,
+				 struct commit_graph *graph);
+extern void cgit_graph_walk_set_path(struct graph_walk *walk,
+				     const char *path,
+				     struct path_bloom *bloom);
+extern int cgit_graph_walk_setup(struct graph_walk *walk, const char *rev,
+				 const char *path);
+extern int cgit_graph_walk_resume(struct graph_walk *walk, const char *cursor,
+				  const char *path);
+extern int cgit_graph_walk_cursor(struct graph_walk *walk,
+				  struct strbuf *cursor, int max);
+extern struct commit *cgit_graph_walk_next(struct graph_walk *walk);
+
+/* Free the queue and close the commit graph and changed-path filters */
+extern void cgit_graph_walk_release(struct graph_walk *walk);
+
+/* (Re)generate the commit graph for the current repository */
+extern int cgit_write_commit_graph(void);
+
+#endif /* COMMIT_GRAPH_H */
@@ -0,0 +1,434 @@
+/* commit-index.c: precomputed log order and metadata for branch tips
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The log index is a sidecar file stored in the repository, generated by
+ * `cgit --build-index`. For each branch it records the commits reachable
+ * from the branch tip in the order `git log <branch>` would list them,
+ * and for each commit the committer date, author and subject. This lets
+ * the log page skip to any offset, and render it, without inflating a
+ * single commit object.
+ *
+ * All integers are stored in network byte order, and the file is laid
+ * out in columns so that it can be used directly through mmap():
+ *
+ *   header       7 x uint32: magic, version, branches, commits, order
+ *                entries, authors, size of string table
+ *   branches     tip sha1, name, first order entry, number of entries
+ *   sha1         one 20-byte sha1 per commit
+ *   date         one uint32 per commit
+ *   author       one uint32 (author number) per commit
+ *   subject      one uint32 (string table offset) per commit
+ *   order        one uint32 (commit number) per order entry
+ *   authors      one uint32 (string table offset) per author
+ *   strings      nul-terminated strings
+ */
+
+#include "cgit.h"
+#include "commit-index.h"
+
+#define INDEX_MAGIC   0x434c4958 /* "CLIX" */
+#define INDEX_VERSION 1
+#define INDEX_FILE    "info/cgit/log-index"
+
+struct index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_branches;
+	uint32_t nr_commits;
+	uint32_t nr_order;
+	uint32_t nr_authors;
+	uint32_t strings_size;
+};
+
+struct index_branch {
+	unsigned char tip[20];
+	uint32_t name;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct commit_index {
+	void *map;
+	size_t size;
+	uint32_t nr_branches;
+	uint32_t nr_commits;
+	uint32_t nr_order;
+	uint32_t nr_authors;
+	uint32_t strings_size;
+	const struct index_branch *branches;
+	const unsigned char *sha1;
+	const uint32_t *date;
+	const uint32_t *author;
+	const uint32_t *subject;
+	const uint32_t *order;
+	const uint32_t *authors;
+	const char *strings;
+};
+
+static const char *index_string(struct commit_index *idx, uint32_t ofs)
+{
+	if (ofs >= idx->strings_size)
+		return "";
+	return idx->strings + ofs;
+}
+
+static int check_index(struct commit_index *idx)
+{
+	uint32_t i;
+
+	for (i = 0; i < idx->nr_branches; i++)
+		if (ntohl(idx->branches[i].first) > idx->nr_order ||
+		    ntohl(idx->branches[i].count) >
+		    idx->nr_order - ntohl(idx->branches[i].first))
+			return -1;
+	for (i = 0; i < idx->nr_order; i++)
+		if (ntohl(idx->order[i]) >= idx->nr_commits)
+			return -1;
+	for (i = 0; i < idx->nr_commits; i++)
+		if (ntohl(idx->author[i]) >= idx->nr_authors)
+			return -1;
+	if (idx->strings_size && idx->strings[idx->strings_size - 1])
+		return -1;
+	return 0;
+}
+
+struct commit_index *cgit_open_commit_index(void)
+{
+	struct commit_index *idx;
+	const struct index_header *hdr;
+	struct stat st;
+	unsigned char *p;
+	uint64_t expected;
+	int fd;
+
+	fd = open(git_path(INDEX_FILE), O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return NULL;
+	}
+	idx = xcalloc(1, sizeof(*idx));
+	idx->size = st.st_size;
+	idx->map = mmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (idx->map == MAP_FAILED) {
+		free(idx);
+		return NULL;
+	}
+	hdr = idx->map;
+	idx->nr_branches = ntohl(hdr->nr_branches);
+	idx->nr_commits = ntohl(hdr->nr_commits);
+	idx->nr_order = ntohl(hdr->nr_order);
+	idx->nr_authors = ntohl(hdr->nr_authors);
+	idx->strings_size = ntohl(hdr->strings_size);
+	expected = sizeof(*hdr) +
+		(uint64_t)idx->nr_branches * sizeof(struct index_branch) +
+		(uint64_t)idx->nr_commits * (20 + 3 * sizeof(uint32_t)) +
+		(uint64_t)idx->nr_order * sizeof(uint32_t) +
+		(uint64_t)idx->nr_authors * sizeof(uint32_t) +
+		idx->strings_size;
+	if (ntohl(hdr->magic) != INDEX_MAGIC ||
+	    ntohl(hdr->version) != INDEX_VERSION ||
+	    expected != idx->size) {
+		cgit_close_commit_index(idx);
+		return NULL;
+	}
+
+	p = (unsigned char *)(hdr + 1);
+	idx->branches = (const struct index_branch *)p;
+	p += idx->nr_branches * sizeof(struct index_branch);
+	idx->sha1 = p;
+	p += idx->nr_commits * 20;
+	idx->date = (const uint32_t *)p;
+	p += idx->nr_commits * sizeof(uint32_t);
+	idx->author = (const uint32_t *)p;
+	p += idx->nr_commits * sizeof(uint32_t);
+	idx->subject = (const uint32_t *)p;
+	p += idx->nr_commits * sizeof(uint32_t);
+	idx->order = (const uint32_t *)p;
+	p += idx->nr_order * sizeof(uint32_t);
+	idx->authors = (const uint32_t *)p;
+	p += idx->nr_authors * sizeof(uint32_t);
+	idx->strings = (const char *)p;
+
+	if (check_index(idx)) {
+		cgit_close_commit_index(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+void cgit_close_commit_index(struct commit_index *idx)
+{
+	if (!idx)
+		return;
+	munmap(idx->map, idx->size);
+	free(idx);
+}
+
+int cgit_commit_index_find(struct commit_index *idx, const unsigned char *tip,
+			   struct commit_index_branch *branch)
+{
+	uint32_t i;
+
+	for (i = 0; i < idx->nr_branches; i++) {
+		if (hashcmp(idx->branches[i].tip, tip))
+			continue;
+		branch->tip = idx->branches[i].tip;
+		branch->first = ntohl(idx->branches[i].first);
+		branch->count = ntohl(idx->branches[i].count);
+		return 0;
+	}
+	return -1;
+}
+
+void cgit_commit_index_get(struct commit_index *idx,
+			   const struct commit_index_branch *branch,
+			   uint32_t pos, struct commit_index_entry *entry)
+{
+	uint32_t n = ntohl(idx->order[branch->first + pos]);
+
+	entry->sha1 = idx->sha1 + n * 20;
+	entry->date = ntohl(idx->date[n]);
+	entry->author = index_string(idx,
+		ntohl(idx->authors[ntohl(idx->author[n])]));
+	entry->subject = index_string(idx, ntohl(idx->subject[n]));
+}
+
+
+/*
+ * Index generation
+ */
+
+struct index_builder {
+	struct commit_index *old;
+	struct index_branch *branches;
+	int branches_nr, branches_alloc;
+	unsigned char (*sha1)[20];
+	uint32_t *date;
+	uint32_t *author;
+	uint32_t *subject;
+	int commits_nr, commits_alloc;
+	uint32_t *order;
+	int order_nr, order_alloc;
+	struct string_list authors;
+	uint32_t *author_names;
+	int authors_nr, authors_alloc;
+	struct strbuf strings;
+};
+
+static uint32_t add_string(struct index_builder *b, const char *str)
+{
+	uint32_t ofs = b->strings.len;
+
+	strbuf_add(&b->strings, str ? str : "", str ? strlen(str) + 1 : 1);
+	return ofs;
+}
+
+static uint32_t add_author(struct index_builder *b, const char *name)
+{
+	struct string_list_item *item;
+
+	item = string_list_insert(&b->authors, name ? name : "");
+	if (!item->util) {
+		ALLOC_GROW(b->author_names, b->authors_nr + 1,
+			   b->authors_alloc);
+		b->author_names[b->authors_nr++] =
+			htonl(add_string(b, item->string));
+		item->util = (void *)(intptr_t)b->authors_nr;
+	}
+	return (intptr_t)item->util - 1;
+}
+
+/* Append a commit to the order table of the current branch, adding its
+ * metadata to the commit columns unless another branch already did.
+ * The column number is remembered in commit->util.
+ */
+static void add_entry(struct index_builder *b, struct commit *commit,
+		      unsigned long date, const char *author,
+		      const char *subject)
+{
+	int n = (intptr_t)commit->util - 1;
+
+	if (n < 0) {
+		n = b->commits_nr++;
+		if (b->commits_nr > b->commits_alloc) {
+			b->commits_alloc = alloc_nr(b->commits_alloc);
+			b->sha1 = xrealloc(b->sha1, b->commits_alloc * 20);
+			b->date = xrealloc(b->date,
+				b->commits_alloc * sizeof(uint32_t));
+			b->author = xrealloc(b->author,
+				b->commits_alloc * sizeof(uint32_t));
+			b->subject = xrealloc(b->subject,
+				b->commits_alloc * sizeof(uint32_t));
+		}
+		hashcpy(b->sha1[n], commit->object.sha1);
+		b->date[n] = htonl(date);
+		b->author[n] = htonl(add_author(b, author));
+		b->subject[n] = htonl(add_string(b, subject));
+		commit->util = (void *)(intptr_t)(n + 1);
+	}
+	ALLOC_GROW(b->order, b->order_nr + 1, b->order_alloc);
+	b->order[b->order_nr++] = htonl(n);
+}
+
+static void add_parsed_entry(struct index_builder *b, struct commit *commit)
+{
+	struct commitinfo *info;
+
+	if (commit->util) {
+		add_entry(b, commit, 0, NULL, NULL);
+		return;
+	}
+	info = cgit_parse_commit_fields(commit,
+		COMMIT_PARSE_AUTHOR | COMMIT_PARSE_SUBJECT);
+	add_entry(b, commit, commit->date, info->author, info->subject);
+	cgit_free_commitinfo(info);
+}
+
+/* Copy the order entries of an existing branch from the old index */
+static void copy_old_entries(struct index_builder *b,
+			     struct commit_index_branch *branch, uint32_t pos)
+{
+	struct commit_index_entry entry;
+	struct commit *commit;
+
+	for (; pos < branch->count; pos++) {
+		cgit_commit_index_get(b->old, branch, pos, &entry);
+		commit = lookup_commit(entry.sha1);
+		if (!commit)
+			die("Bad commit in log index: %s",
+			    sha1_to_hex(entry.sha1));
+		add_entry(b, commit, entry.date, entry.author, entry.subject);
+	}
+}
+
+/* Walk the history of `tip` in the same order as get_revision() does for
+ * a plain `git log <tip>`: by commit date, most recent first. If the walk
+ * is about to pop the tip of a previously indexed branch and no other
+ * commits are pending, the rest of the history is copied from the old
+ * index.
+ */
+static void index_branch(struct index_builder *b, const char *refname,
+			 const unsigned char *sha1)
+{
+	struct commit_list *list = NULL, *visited = NULL, *p, *parent;
+	struct commit_index_branch old_branch;
+	struct commit *commit;
+	struct index_branch *branch;
+
+	commit = lookup_commit_reference_gently(sha1, 1);
+	if (!commit || parse_commit(commit))
+		return;
+
+	ALLOC_GROW(b->branches, b->branches_nr + 1, b->branches_alloc);
+	branch = &b->branches[b->branches_nr++];
+	hashcpy(branch->tip, commit->object.sha1);
+	branch->name = htonl(add_string(b, refname));
+	branch->first = b->order_nr;
+
+	commit->object.flags |= TMP_MARK;
+	commit_list_insert(commit, &list);
+	while (list) {
+		if (b->old && !list->next &&
+		    !cgit_commit_index_find(b->old, list->item->object.sha1,
+					    &old_branch)) {
+			copy_old_entries(b, &old_branch, 0);
+			break;
+		}
+		commit = pop_most_recent_commit(&list, TMP_MARK);
+		commit_list_insert(commit, &visited);
+		add_parsed_entry(b, commit);
+		free(commit->buffer);
+		commit->buffer = NULL;
+	}
+	for (p = list; p; p = p->next)
+		p->item->object.flags &= ~TMP_MARK;
+	free_commit_list(list);
+	for (p = visited; p; p = p->next) {
+		p->item->object.flags &= ~TMP_MARK;
+		for (parent = p->item->parents; parent; parent = parent->next)
+			parent->item->object.flags &= ~TMP_MARK;
+	}
+	free_commit_list(visited);
+
+	branch->count = htonl(b->order_nr - branch->first);
+	branch->first = htonl(branch->first);
+}
+
+static int index_ref_cb(const char *refname, const unsigned char *sha1,
+			int flags, void *cb_data)
+{
+	index_branch(cb_data, fmt("refs/heads/%s", refname), sha1);
+	return 0;
+}
+
+static int write_index(struct index_builder *b, int fd)
+{
+	struct index_header hdr;
+
+	hdr.magic = htonl(INDEX_MAGIC);
+	hdr.version = htonl(INDEX_VERSION);
+	hdr.nr_branches = htonl(b->branches_nr);
+	hdr.nr_commits = htonl(b->commits_nr);
+	hdr.nr_order = htonl(b->order_nr);
+	hdr.nr_authors = htonl(b->authors_nr);
+	hdr.strings_size = htonl(b->strings.len);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, b->branches,
+			  b->branches_nr * sizeof(*b->branches)) < 0 ||
+	    write_in_full(fd, b->sha1, b->commits_nr * 20) < 0 ||
+	    write_in_full(fd, b->date, b->commits_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->author,
+			  b->commits_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->subject,
+			  b->commits_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->order, b->order_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->author_names,
+			  b->authors_nr * sizeof(uint32_t)) < 0 ||
+	    write_in_full(fd, b->strings.buf, b->strings.len) < 0)
+		return errno;
+	return 0;
+}
+
+/* Generate the log index for all branches of the current repository,
+ * reusing the history of branches which were already indexed. Return 0
+ * on success and errno otherwise.
+ */
+int cgit_write_commit_index(void)
+{
+	struct index_builder b;
+	char *path, *lock;
+	int fd, err;
+
+	path = xstrdup(git_path(INDEX_FILE));
+	lock = xstrdup(fmt("%s.lock", path));
+	if (safe_create_leading_directories(lock) ||
+	    (fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0) {
+		err = errno ? errno : EINVAL;
+		free(lock);
+		free(path);
+		return err;
+	}
+
+	memset(&b, 0, sizeof(b));
+	strbuf_init(&b.strings, 0);
+	b.authors.strdup_strings = 1;
+	b.old = cgit_open_commit_index();
+	for_each_branch_ref(index_ref_cb, &b);
+	err = write_index(&b, fd);
+	if (close(fd) && !err)
+		err = errno;
+	cgit_close_commit_index(b.old);
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	free(lock);
+	free(path);
+	return err;
+}
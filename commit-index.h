@@ -0,0 +1,40 @@
+#ifndef COMMIT_INDEX_H
+#define COMMIT_INDEX_H
+
+#include "cgit.h"
+
+struct commit_index;
+
+/* The commits reachable from a branch tip, in log order */
+struct commit_index_branch {
+	const unsigned char *tip;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct commit_index_entry {
+	const unsigned char *sha1;
+	unsigned long date;
+	const char *author;
+	const char *subject;
+};
+
+/* Open the log index for the current repository, NULL if unavailable */
+extern struct commit_index *cgit_open_commit_index(void);
+extern void cgit_close_commit_index(struct commit_index *idx);
+
+/* Find the branch starting at `tip`, return 0 on success */
+extern int cgit_commit_index_find(struct commit_index *idx,
+				  const unsigned char *tip,
+				  struct commit_index_branch *branch);
+
+/* Fetch entry number `pos` (0 is the tip) of an indexed branch */
+extern void cgit_commit_index_get(struct commit_index *idx,
+				  const struct commit_index_branch *branch,
+				  uint32_t pos,
+				  struct commit_index_entry *entry);
+
+/* (Re)generate the log index for the current repository */
+extern int cgit_write_commit_index(void);
+
+#endif /* COMMIT_INDEX_H */
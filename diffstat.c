@@ -0,0 +1,395 @@
+/* diffstat.c: persistent cache of per-commit diffstats
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The diffstat cache is a single hash table file, "diffstat" in the cache
+ * root, shared by all repositories. Entries are keyed by the sha1 of the
+ * parent tree, the commit tree and the diff options affecting the counts,
+ * so identical changes (e.g. in forks or rebased commits) share an entry.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       4 x uint32: magic, version, number of slots (a power of
+ *                two), number of used slots
+ *   slots        key, number of files, added lines, removed lines
+ *
+ * An unused slot has a null key, and the line counts are DIFFSTAT_NO_LINES
+ * if only the files were counted. Collisions are resolved by linear
+ * probing.
+ *
+ * The table is updated in place while holding "diffstat.lock" (see
+ * cgit_open_lock()). When the table gets more than half full, it is
+ * rewritten with twice the number of slots into the lock file, which is
+ * then renamed over the table. Once it would exceed DIFFSTAT_MAX_SLOTS,
+ * the table is started over instead. If the lock is held by someone else,
+ * the result is simply not cached.
+ *
+ * Like the page cache, the table is only written to if cache-size is
+ * set, or when it is built by --build-index.
+ */
+
+#include "cgit.h"
+#include "diffstat.h"
+#include "commit-graph.h"
+
+#define DIFFSTAT_MAGIC     0x43445354 /* "CDST" */
+#define DIFFSTAT_VERSION   1
+#define DIFFSTAT_MIN_SLOTS 1024
+#define DIFFSTAT_MAX_SLOTS (1 << 20)
+#define DIFFSTAT_NO_LINES  -1
+
+struct diffstat_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_slots;
+	uint32_t nr_used;
+};
+
+struct diffstat_slot {
+	unsigned char key[20];
+	uint32_t files;
+	uint32_t added;
+	uint32_t removed;
+};
+
+struct diffstat_table {
+	int fd;
+	void *map;
+	size_t size;
+	uint32_t nr_slots;
+	uint32_t nr_used;
+	const struct diffstat_slot *slots;
+};
+
+static struct diffstat_table table = { -1 };
+static struct cgit_diffstat *current;
+static int count_lines;
+static int writable;
+
+static const char *table_path(void)
+{
+	return fmt("%s/diffstat", ctx.cfg.cache_root);
+}
+
+static void close_table(void)
+{
+	if (table.map)
+		munmap(table.map, table.size);
+	if (table.fd >= 0)
+		close(table.fd);
+	memset(&table, 0, sizeof(table));
+	table.fd = -1;
+}
+
+/* Map the table, return 0 on success and errno otherwise */
+static int open_table(void)
+{
+	const struct diffstat_header *hdr;
+	struct stat st;
+
+	if (table.map)
+		return 0;
+	table.fd = open(table_path(), O_RDWR);
+	if (table.fd < 0)
+		return errno;
+	if (fstat(table.fd, &st) || st.st_size < sizeof(*hdr)) {
+		close_table();
+		return EINVAL;
+	}
+	table.size = st.st_size;
+	table.map = mmap(NULL, table.size, PROT_READ, MAP_SHARED, table.fd, 0);
+	if (table.map == MAP_FAILED) {
+		table.map = NULL;
+		close_table();
+		return errno;
+	}
+	hdr = table.map;
+	table.nr_slots = ntohl(hdr->nr_slots);
+	table.nr_used = ntohl(hdr->nr_used);
+	if (ntohl(hdr->magic) != DIFFSTAT_MAGIC ||
+	    ntohl(hdr->version) != DIFFSTAT_VERSION ||
+	    !table.nr_slots || (table.nr_slots & (table.nr_slots - 1)) ||
+	    sizeof(*hdr) + (uint64_t)table.nr_slots *
+	    sizeof(struct diffstat_slot) != table.size) {
+		close_table();
+		return EINVAL;
+	}
+	table.slots = (const struct diffstat_slot *)(hdr + 1);
+	return 0;
+}
+
+/* Find the slot holding `key`, or the empty slot where it belongs */
+static int find_slot(const struct diffstat_slot *slots, uint32_t nr_slots,
+		     const unsigned char *key)
+{
+	uint32_t i, n;
+
+	i = (key[0] << 24 | key[1] << 16 | key[2] << 8 | key[3]) &
+		(nr_slots - 1);
+	for (n = 0; n < nr_slots; n++, i = (i + 1) & (nr_slots - 1))
+		if (is_null_sha1(slots[i].key) || !hashcmp(slots[i].key, key))
+			return i;
+	return -1;
+}
+
+static int lookup(const unsigned char *key, struct cgit_diffstat *stat)
+{
+	const struct diffstat_slot *slot;
+	int i;
+
+	if (open_table())
+		return -1;
+	i = find_slot(table.slots, table.nr_slots, key);
+	if (i < 0 || is_null_sha1(table.slots[i].key))
+		return -1;
+	slot = &table.slots[i];
+	stat->files = ntohl(slot->files);
+	stat->added = ntohl(slot->added);
+	stat->removed = ntohl(slot->removed);
+	return 0;
+}
+
+static void fill_slot(struct diffstat_slot *slot, const unsigned char *key,
+		      struct cgit_diffstat *stat)
+{
+	hashcpy(slot->key, key);
+	slot->files = htonl(stat->files);
+	slot->added = htonl(stat->added);
+	slot->removed = htonl(stat->removed);
+}
+
+/* Write a new table with room for one more entry into the lock file. If
+ * the table would grow beyond DIFFSTAT_MAX_SLOTS, the old entries are
+ * dropped.
+ */
+static int grow_table(int fd, const unsigned char *key,
+		      struct cgit_diffstat *stat)
+{
+	struct diffstat_header hdr;
+	struct diffstat_slot *slots;
+	uint32_t nr_slots = DIFFSTAT_MIN_SLOTS, nr_used = 0, nr_old, i;
+	int err = 0;
+
+	nr_old = table.nr_slots;
+	while (nr_slots / 2 < table.nr_used + 1)
+		nr_slots *= 2;
+	if (nr_slots > DIFFSTAT_MAX_SLOTS) {
+		nr_slots = DIFFSTAT_MIN_SLOTS;
+		nr_old = 0;
+	}
+	slots = xcalloc(nr_slots, sizeof(*slots));
+	for (i = 0; i < nr_old; i++) {
+		if (is_null_sha1(table.slots[i].key) ||
+		    !hashcmp(table.slots[i].key, key))
+			continue;
+		slots[find_slot(slots, nr_slots, table.slots[i].key)] =
+			table.slots[i];
+		nr_used++;
+	}
+	fill_slot(&slots[find_slot(slots, nr_slots, key)], key, stat);
+	nr_used++;
+
+	hdr.magic = htonl(DIFFSTAT_MAGIC);
+	hdr.version = htonl(DIFFSTAT_VERSION);
+	hdr.nr_slots = htonl(nr_slots);
+	hdr.nr_used = htonl(nr_used);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, slots, nr_slots * sizeof(*slots)) < 0)
+		err = errno;
+	free(slots);
+	return err;
+}
+
+/* Add an entry to the table in place */
+static int update_table(const unsigned char *key, struct cgit_diffstat *stat)
+{
+	struct diffstat_slot slot;
+	uint32_t nr_used;
+	off_t ofs;
+	int i;
+
+	i = find_slot(table.slots, table.nr_slots, key);
+	ofs = sizeof(struct diffstat_header) + (off_t)i * sizeof(slot);
+	nr_used = table.nr_used;
+	if (is_null_sha1(table.slots[i].key))
+		nr_used++;
+	nr_used = htonl(nr_used);
+	fill_slot(&slot, key, stat);
+
+	/* Write the key last, readers only trust slots with a key */
+	if (pwrite(table.fd, &slot.files, sizeof(slot) - 20, ofs + 20) < 0 ||
+	    pwrite(table.fd, slot.key, 20, ofs) < 0 ||
+	    pwrite(table.fd, &nr_used,  sizeof(nr_used),
+		   offsetof(struct diffstat_header, nr_used)) < 0)
+		return errno;
+	table.nr_used = ntohl(nr_used);
+	return 0;
+}
+
+/* Bring the mapped table up to date with the file, which may have been
+ * updated in place or replaced by another process since it was opened.
+ */
+static void refresh_table(const char *path)
+{
+	const struct diffstat_header *hdr;
+	struct stat st, cur;
+
+	if (table.map && !fstat(table.fd, &cur) && !stat(path, &st) &&
+	    st.st_dev == cur.st_dev && st.st_ino == cur.st_ino) {
+		hdr = table.map;
+		table.nr_used = ntohl(hdr->nr_used);
+		return;
+	}
+	close_table();
+	open_table();
+}
+
+/* Store an entry, return 0 on success and errno otherwise */
+static int store(const unsigned char *key, struct cgit_diffstat *stat)
+{
+	char *path, *lock;
+	int fd, err;
+
+	if (!writable && ctx.cfg.cache_size <= 0)
+		return 0;
+	path = xstrdup(table_path());
+	lock = xstrdup(fmt("%s.lock", path));
+	fd = cgit_open_lock(lock);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	refresh_table(path);
+	if (table.map && table.nr_used + 1 <= table.nr_slots / 2) {
+		err = update_table(key, stat);
+		unlink(lock);
+		close(fd);
+		goto out;
+	}
+	err = grow_table(fd, key, stat);
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	close(fd);
+	close_table();
+out:
+	free(lock);
+	free(path);
+	return err;
+}
+
+/* The key covers everything which affects the counts */
+static void diffstat_key(const unsigned char *old_tree,
+			 const unsigned char *new_tree, unsigned char *key)
+{
+	git_SHA_CTX c;
+	const char *opts;
+
+	opts = fmt("ignorews=%d renamelimit=%d", ctx.qry.ignorews,
+		   ctx.cfg.renamelimit);
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, old_tree ? old_tree : null_sha1, 20);
+	git_SHA1_Update(&c, new_tree, 20);
+	git_SHA1_Update(&c, opts, strlen(opts));
+	git_SHA1_Final(key, &c);
+}
+
+static void inspect_file(struct diff_filepair *pair)
+{
+	unsigned long old_size = 0;
+	unsigned long new_size = 0;
+	int binary = 0, added, removed;
+
+	current->files++;
+	if (!count_lines)
+		return;
+	cgit_diff_files_count(pair->one->sha1, pair->two->sha1, &old_size,
+			      &new_size, &binary, ctx.qry.ignorews, &added,
+			      &removed);
+	current->added += added;
+	current->removed += removed;
+}
+
+void cgit_commit_diffstat(struct commit *commit, int lines,
+			  struct cgit_diffstat *stat)
+{
+	struct commit *parent = NULL;
+	unsigned char key[20];
+	int cacheable;
+
+	if (commit->parents) {
+		parent = commit->parents->item;
+		parse_commit(parent);
+	}
+	cacheable = commit->tree && (!parent || parent->tree);
+	if (cacheable) {
+		diffstat_key(parent ? parent->tree->object.sha1 : NULL,
+			     commit->tree->object.sha1, key);
+		if (!lookup(key, stat) &&
+		    (!lines || stat->added != DIFFSTAT_NO_LINES))
+			return;
+	}
+
+	memset(stat, 0, sizeof(*stat));
+	current = stat;
+	count_lines = lines;
+	cgit_diff_commit(commit, inspect_file);
+	if (!lines)
+		stat->added = stat->removed = DIFFSTAT_NO_LINES;
+	if (cacheable)
+		store(key, stat);
+}
+
+static int diffstat_ref_cb(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	struct commit *commit;
+
+	commit = lookup_commit_reference_gently(sha1, 1);
+	if (commit && !(commit->object.flags & SEEN)) {
+		commit->object.flags |= SEEN;
+		commit_list_insert(commit, cb_data);
+	}
+	return 0;
+}
+
+/* Compute the diffstats of all commits reachable from the refs, which
+ * are not cached yet. Return 0 on success and errno otherwise.
+ */
+int cgit_write_diffstats(void)
+{
+	struct commit_graph *graph;
+	struct commit_list *stack = NULL, *p;
+	struct commit *commit;
+	struct cgit_diffstat stat;
+
+	if (access(ctx.cfg.cache_root, W_OK))
+		return errno;
+	writable = 1;
+	graph = cgit_open_commit_graph();
+	for_each_ref(diffstat_ref_cb, &stack);
+	while (stack) {
+		commit = pop_commit(&stack);
+		if (cgit_commit_graph_fill(graph, commit, NULL) &&
+		    parse_commit(commit))
+			continue;
+		free(commit->buffer);
+		commit->buffer = NULL;
+		for (p = commit->parents; p; p = p->next) {
+			if (p->item->object.flags & SEEN)
+				continue;
+			p->item->object.flags |= SEEN;
+			if (cgit_commit_graph_fill(graph, p->item, NULL))
+				parse_commit(p->item);
+			commit_list_insert(p->item, &stack);
+		}
+		cgit_commit_diffstat(commit, 1, &stat);
+	}
+	cgit_close_commit_graph(graph);
+	close_table();
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DIFFSTAT_H
+#define DIFFSTAT_H
+
+#include "cgit.h"
+
+struct cgit_diffstat {
+	int files;
+	int added;
+	int removed;
+};
+
+/* Count the files (and, if `lines` is set, the lines) changed by `commit`
+ * compared to its first parent, using the diffstat cache if possible.
+ */
+extern void cgit_commit_diffstat(struct commit *commit, int lines,
+				 struct cgit_diffstat *stat);
+
+/* Fill the diffstat cache for all commits of the current repository */
+extern int cgit_write_diffstats(void);
+
+#endif /* DIFFSTAT_H */
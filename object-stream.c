@@ -0,0 +1,317 @@
+/* object-stream.c: read object content without loading it into memory
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * An undeltified packed object is inflated from the pack windows, a
+ * buffer at a time. A loose object is a zlib stream of "type size\0"
+ * followed by the content, which is inflated the same way from its file
+ * after the header has been checked. Deltified objects have to be
+ * reconstructed in memory, so they are read with read_sha1_file() and
+ * served from that buffer, as are loose objects found in alternates only.
+ *
+ * Seeking forward inflates and drops the content in between, seeking
+ * backward inflates the object from the start again. The first bytes
+ * inflated by cgit_peek_object_stream() are kept, so reading them again
+ * is free.
+ */
+
+#include "cgit.h"
+#include "object-stream.h"
+
+#define OBJECT_STREAM_BUFSIZE 65536
+
+static int open_packed(const unsigned char *sha1, struct object_stream *st)
+{
+	struct packed_git *p;
+	enum object_type type;
+	unsigned long size, used;
+	unsigned char *base;
+	unsigned int left;
+	off_t ofs;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		ofs = find_pack_entry_one(sha1, p);
+		if (ofs)
+			break;
+	}
+	if (!p)
+		return -1;
+	base = use_pack(p, &st->w_curs, ofs, &left);
+	used = unpack_object_header_buffer(base, left, &type, &size);
+	if (!used || type != st->type || size != st->size) {
+		unuse_pack(&st->w_curs);
+		return -1;
+	}
+	st->pack = p;
+	st->curpos = ofs + used;
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->inflating = 1;
+	return 0;
+}
+
+/* Inflate at most `len` bytes, return the number of bytes inflated */
+static ssize_t inflate_some(struct object_stream *st, char *out, size_t len)
+{
+	unsigned char *in;
+	unsigned int avail;
+	ssize_t n;
+	int status;
+
+	if (st->pack)
+		in = use_pack(st->pack, &st->w_curs, st->curpos, &avail);
+	else if (st->z.avail_in) {
+		in = st->z.next_in;
+		avail = st->z.avail_in;
+	} else {
+		n = xread(st->fd, st->inbuf, OBJECT_STREAM_BUFSIZE);
+		if (n < 0)
+			return -1;
+		in = st->inbuf;
+		avail = n;
+	}
+	st->z.next_in = in;
+	st->z.avail_in = avail;
+	st->z.next_out = (unsigned char *)out;
+	st->z.avail_out = len;
+	status = git_inflate(&st->z, Z_NO_FLUSH);
+	st->curpos += st->z.next_in - in;
+	if (status == Z_STREAM_END)
+		st->done = 1;
+	else if (status != Z_OK && status != Z_BUF_ERROR)
+		return -1;
+	else if (len == st->z.avail_out && st->z.next_in == in)
+		return -1;
+	return len - st->z.avail_out;
+}
+
+/* Undo open_loose() after a bad header */
+static void close_loose(struct object_stream *st)
+{
+	git_inflate_end(&st->z);
+	st->inflating = 0;
+	st->done = 0;
+	close(st->fd);
+	free(st->inbuf);
+	st->inbuf = NULL;
+}
+
+static int open_loose(const unsigned char *sha1, struct object_stream *st)
+{
+	char hdr[32], *end;
+	unsigned long size;
+	int fd, i;
+
+	fd = open(sha1_file_name(sha1), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	st->fd = fd;
+	st->inbuf = xmalloc(OBJECT_STREAM_BUFSIZE);
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->inflating = 1;
+
+	/* Inflate the header a byte at a time, to stop right at its end */
+	for (i = 0; ; i++) {
+		if (i == sizeof(hdr) || st->done ||
+		    inflate_some(st, hdr + i, 1) != 1)
+			goto fail;
+		if (!hdr[i])
+			break;
+	}
+	end = strchr(hdr, ' ');
+	if (!end)
+		goto fail;
+	*end++ = '\0';
+	size = strtoul(end, &end, 10);
+	if (*end || strcmp(hdr, typename(st->type)) || size != st->size)
+		goto fail;
+	return 0;
+fail:
+	close_loose(st);
+	return -1;
+}
+
+int cgit_open_object_stream(const unsigned char *sha1,
+			    struct object_stream *st)
+{
+	enum object_type type;
+	unsigned long size;
+
+	memset(st, 0, sizeof(*st));
+	hashcpy(st->sha1, sha1);
+	st->type = sha1_object_info(sha1, &st->size);
+	if (st->type <= OBJ_NONE)
+		return -1;
+	if (!open_packed(sha1, st) || !open_loose(sha1, st))
+		return 0;
+	st->buf = read_sha1_file(sha1, &type, &size);
+	if (!st->buf)
+		return -1;
+	st->type = type;
+	st->size = size;
+	return 0;
+}
+
+/* Inflate exactly `len` bytes, return 0 on success and -1 if the object is
+ * corrupt.
+ */
+static int inflate_full(struct object_stream *st, char *out, size_t len)
+{
+	size_t total = 0;
+	ssize_t got;
+
+	while (total < len) {
+		if (st->done)
+			return -1;
+		got = inflate_some(st, out + total, len - total);
+		if (got < 0)
+			return -1;
+		total += got;
+	}
+	st->zpos += len;
+	return 0;
+}
+
+/* Reopen the object to inflate it from the start again */
+static int restart(struct object_stream *st)
+{
+	unsigned char sha1[20];
+	char *peek = st->peek;
+	unsigned long peek_len = st->peek_len, pos = st->pos;
+
+	hashcpy(sha1, st->sha1);
+	st->peek = NULL;
+	cgit_close_object_stream(st);
+	if (cgit_open_object_stream(sha1, st)) {
+		free(peek);
+		return -1;
+	}
+	st->peek = peek;
+	st->peek_len = peek_len;
+	st->pos = pos;
+	return 0;
+}
+
+/* Move the inflater to offset `ofs` of the content */
+static int position(struct object_stream *st, unsigned long ofs)
+{
+	char *scratch;
+	unsigned long n;
+	int err = 0;
+
+	if (st->zpos > ofs && restart(st))
+		return -1;
+	if (st->zpos == ofs)
+		return 0;
+	scratch = xmalloc(OBJECT_STREAM_BUFSIZE);
+	while (!err && st->zpos < ofs) {
+		n = ofs - st->zpos;
+		if (n > OBJECT_STREAM_BUFSIZE)
+			n = OBJECT_STREAM_BUFSIZE;
+		err = inflate_full(st, scratch, n);
+	}
+	free(scratch);
+	return err;
+}
+
+const char *cgit_peek_object_stream(struct object_stream *st,
+				    unsigned long *len)
+{
+	if (st->buf) {
+		*len = st->size < OBJECT_STREAM_PEEK ? st->size : OBJECT_STREAM_PEEK;
+		return st->buf;
+	}
+	if (!st->peek) {
+		st->peek_len = st->size < OBJECT_STREAM_PEEK ?
+			st->size : OBJECT_STREAM_PEEK;
+		st->peek = xmalloc(st->peek_len ? st->peek_len : 1);
+		if (position(st, 0) ||
+		    inflate_full(st, st->peek, st->peek_len)) {
+			free(st->peek);
+			st->peek = NULL;
+			st->peek_len = 0;
+			return NULL;
+		}
+	}
+	*len = st->peek_len;
+	return st->peek;
+}
+
+ssize_t cgit_read_object_stream(struct object_stream *st, void *buf,
+				size_t len)
+{
+	char *out = buf;
+	size_t n = 0;
+
+	if (len > st->size - st->pos)
+		len = st->size - st->pos;
+	if (st->buf) {
+		memcpy(out, st->buf + st->pos, len);
+		st->pos += len;
+		return len;
+	}
+	if (st->pos < st->peek_len) {
+		n = st->peek_len - st->pos;
+		if (n > len)
+			n = len;
+		memcpy(out, st->peek + st->pos, n);
+	}
+	if (n < len && (position(st, st->pos + n) ||
+			inflate_full(st, out + n, len - n)))
+		return -1;
+	st->pos += len;
+	return len;
+}
+
+void cgit_seek_object_stream(struct object_stream *st, unsigned long ofs)
+{
+	st->pos = ofs < st->size ? ofs : st->size;
+}
+
+int cgit_copy_object_stream(struct object_stream *st, int fd,
+			    unsigned long len)
+{
+	char *buf = xmalloc(OBJECT_STREAM_BUFSIZE);
+	ssize_t n;
+	int err = 0;
+
+	while (len && st->pos < st->size) {
+		n = cgit_read_object_stream(st, buf, len < OBJECT_STREAM_BUFSIZE ?
+					    len : OBJECT_STREAM_BUFSIZE);
+		if (n <= 0 || write_in_full(fd, buf, n) < 0) {
+			err = -1;
+			break;
+		}
+		len -= n;
+	}
+	free(buf);
+	return err;
+}
+
+int cgit_object_stream_range(void *data, int fd, unsigned long ofs,
+			     unsigned long len)
+{
+	struct object_stream *st = data;
+
+	cgit_seek_object_stream(st, ofs);
+	return cgit_copy_object_stream(st, fd, len);
+}
+
+void cgit_close_object_stream(struct object_stream *st)
+{
+	if (st->inflating)
+		git_inflate_end(&st->z);
+	if (st->w_curs)
+		unuse_pack(&st->w_curs);
+	if (st->inbuf) {
+		close(st->fd);
+		free(st->inbuf);
+	}
+	free(st->buf);
+	free(st->peek);
+	memset(st, 0, sizeof(*st));
+}
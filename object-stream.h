@@ -0,0 +1,66 @@
+#ifndef OBJECT_STREAM_H
+#define OBJECT_STREAM_H
+
+#include "cgit.h"
+
+/* The number of bytes buffer_is_binary() looks at */
+#define OBJECT_STREAM_PEEK 8000
+
+/* The content of an object, inflated piece by piece from its pack or its
+ * loose object file. Deltified objects, and loose objects of alternates,
+ * are read into memory as a whole.
+ */
+struct object_stream {
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+	unsigned long pos;
+	unsigned long zpos;
+	char *peek;
+	unsigned long peek_len;
+	z_stream z;
+	int inflating;
+	int done;
+	struct packed_git *pack;
+	struct pack_window *w_curs;
+	off_t curpos;
+	int fd;
+	unsigned char *inbuf;
+	char *buf;
+};
+
+/* Open the object `sha1` for reading, return 0 on success and -1 if the
+ * object cannot be read.
+ */
+extern int cgit_open_object_stream(const unsigned char *sha1,
+				   struct object_stream *st);
+
+/* Return the first OBJECT_STREAM_PEEK bytes of content (fewer if the
+ * object is smaller), storing their number in `len`, or NULL if the object
+ * is corrupt. The read position is not changed.
+ */
+extern const char *cgit_peek_object_stream(struct object_stream *st,
+					   unsigned long *len);
+
+/* Read up to `len` bytes of content, fewer only at the end of the object.
+ * Return the number of bytes read, or -1 if the object is corrupt.
+ */
+extern ssize_t cgit_read_object_stream(struct object_stream *st, void *buf,
+				       size_t len);
+
+extern void cgit_seek_object_stream(struct object_stream *st,
+				    unsigned long ofs);
+
+/* Write up to `len` bytes of content to `fd`, return 0 on success */
+extern int cgit_copy_object_stream(struct object_stream *st, int fd,
+				   unsigned long len);
+
+/* Write `len` bytes from offset `ofs` of the stream `data` to `fd`, as a
+ * range callback for cgit_print_http_ranged().
+ */
+extern int cgit_object_stream_range(void *data, int fd, unsigned long ofs,
+				    unsigned long len);
+
+extern void cgit_close_object_stream(struct object_stream *st);
+
+#endif /* OBJECT_STREAM_H */
@@ -58,6 +58,103 @@ static int path_prefix(const char *path, const char *prefix)
 		return !strcmp(path, prefix);
 }
 
+/* The entries of a tree, in tree order. Trees are indexed once per request
+ * and then searched by binary search for each path component.
+ */
+struct tree_index {
+	unsigned char sha1[20];
+	char *buf;
+	struct name_entry *entries;
+	int *lengths;
+	int nr;
+	struct tree_index *next;
+};
+
+static struct tree_index *tree_indexes[256];
+
+static struct tree_index *index_tree(const unsigned char *sha1)
+{
+	struct tree_index *idx;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	int alloc = 0;
+
+	for (idx = tree_indexes[sha1[0]]; idx; idx = idx->next)
+		if (!hashcmp(idx->sha1, sha1))
+			return idx;
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->buf = read_sha1_file(sha1, &type, &size);
+	if (!idx->buf || type != OBJ_TREE) {
+		free(idx->buf);
+		free(idx);
+		return NULL;
+	}
+	hashcpy(idx->sha1, sha1);
+	init_tree_desc(&desc, idx->buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (idx->nr >= alloc) {
+			alloc = alloc_nr(alloc);
+			idx->entries = xrealloc(idx->entries,
+						alloc * sizeof(*idx->entries));
+			idx->lengths = xrealloc(idx->lengths,
+						alloc * sizeof(*idx->lengths));
+		}
+		idx->entries[idx->nr] = entry;
+		idx->lengths[idx->nr++] = tree_entry_len(entry.path, entry.sha1);
+	}
+	idx->next = tree_indexes[sha1[0]];
+	tree_indexes[sha1[0]] = idx;
+	return idx;
+}
+
+/* Compare `name` to entry `i` the way trees are sorted, i.e. with a '/'
+ * appended to the names of directories.
+ */
+static int compare_entry(const char *name, int len, int dir,
+			 struct tree_index *idx, int i)
+{
+	const char *path = idx->entries[i].path;
+	int pathlen = idx->lengths[i];
+	int n = len < pathlen ? len : pathlen;
+	int c1, c2, cmp;
+
+	cmp = memcmp(name, path, n);
+	if (cmp)
+		return cmp;
+	c1 = n < len ? (unsigned char)name[n] : (dir ? '/' : '\0');
+	c2 = n < pathlen ? (unsigned char)path[n] :
+		(S_ISDIR(idx->entries[i].mode) ? '/' : '\0');
+	return c1 - c2;
+}
+
+/* Return the entry of the tree named by the first `len` characters of
+ * `name`, or NULL if there is none.
+ */
+static struct name_entry *find_entry(struct tree_index *idx, const char *name,
+				     int len)
+{
+	int dir, lo, hi, mi, cmp;
+
+	for (dir = 0; dir < 2; dir++) {
+		lo = 0;
+		hi = idx->nr;
+		while (lo < hi) {
+			mi = lo + (hi - lo) / 2;
+			cmp = compare_entry(name, len, dir, idx, mi);
+			if (!cmp)
+				return &idx->entries[mi];
+			if (cmp < 0)
+				hi = mi;
+			else
+				lo = mi + 1;
+		}
+	}
+	return NULL;
+}
+
 static int follow_symlink(const unsigned char *sha1, struct strbuf *path,
 			  int start, const char *pathname, char **errmsg)
 {
@@ -91,19 +188,18 @@ static int walk_tree(const unsigned char *sha1_root, struct strbuf *pathbuf,
 		     unsigned char *sha1_out, int *mode, char **errmsg,
 		     int maxlinks)
 {
-	static struct tree *trees[MAX_DEPTH];
 	static struct name_entry entries[MAX_DEPTH];
+	struct tree *root;
 	char *p;
 	int depth;
 
 	if (maxlinks == 0)
 		ERROR("Too many symbolic links");
 
-	memset(trees, 0, sizeof trees);
-	trees[0] = parse_tree_indirect(sha1_root);
-	if (!trees[0])
+	root = parse_tree_indirect(sha1_root);
+	if (!root)
 		ERROR("Invalid sha1: %s", sha1_to_hex(sha1_root));
-	entries[0].sha1 = trees[0]->object.sha1;
+	entries[0].sha1 = root->object.sha1;
 	entries[0].path = "";
 	entries[0].mode = S_IFDIR;
 
@@ -117,17 +213,14 @@ static int walk_tree(const unsigned char *sha1_root, struct strbuf *pathbuf,
 		return 0;
 	}
 	for (depth = 0; depth < MAX_DEPTH-1; depth++) {
-		struct tree *tree;
-		struct tree_desc desc;
+		struct tree_index *idx;
 		struct name_entry *entry;
-		int found;
 		char *slash;
 
 		while (path_prefix(p, "..")) {
 			if (depth <= 0)
 				ERROR("Symbolic link outside top level: %s",
 				      pathbuf->buf);
-			trees[depth] = NULL;
 			depth--;
 			if (p[2] == '\0' || (p[2] == '/' && p[3] == '\0')) {
 				memcpy(sha1_out, entries[depth].sha1, 20);
@@ -137,31 +230,28 @@ static int walk_tree(const unsigned char *sha1_root, struct strbuf *pathbuf,
 			p += 3;
 		}
 
-		tree = trees[depth];
-		if (!tree) {
-			tree = lookup_tree(entries[depth].sha1);
-			if (!tree || parse_tree(tree))
-				ERROR("Invalid tree");
-			trees[depth] = tree;
+		/* A trailing slash names the directory itself */
+		if (depth > 0 && *p == '\0') {
+			memcpy(sha1_out, entries[depth].sha1, 20);
+			*mode = entries[depth].mode;
+			return 0;
 		}
-		init_tree_desc(&desc, tree->buffer, tree->size);
 
-		entry = &entries[depth+1];
-		found = 0;
-		while (tree_entry(&desc, entry)) {
-			if (path_prefix(p, entry->path)) {
-				found = 1;
-				break;
-			}
-		}
+		idx = index_tree(entries[depth].sha1);
+		if (!idx)
+			ERROR("Invalid tree");
 
 		slash = strchr(p, '/');
-		if (!found) {
+		entry = find_entry(idx, p, slash ? slash - p : strlen(p));
+		if (!entry) {
 			if (maxlinks > 0 && maxlinks < MAX_SYMLINKS)
 				ERROR("Broken symblic link");
 			else
 				ERROR("File not found");
-		} else if (S_ISLNK(entry->mode) && maxlinks > 0) {
+		}
+		entries[depth+1] = *entry;
+		entry = &entries[depth+1];
+		if (S_ISLNK(entry->mode) && maxlinks > 0) {
 			if (follow_symlink(entry->sha1, pathbuf,
 					   p-pathbuf->buf, entry->path,
 					   errmsg))
@@ -62,6 +62,9 @@ char *substr(const char *head, const char *tail)
 	return buf;
 }
 
+/* Parse an "author"/"committer"/"tagger" header line. If name or email
+ * is NULL, the corresponding part is skipped without being copied.
+ */
 char *parse_user(char *t, char **name, char **email, unsigned long *date)
 {
 	char *p = t;
@@ -69,19 +72,23 @@ char *parse_user(char *t, char **name, char **email, unsigned long *date)
 
 	while (p && *p) {
 		if (mode == 1 && *p == '<') {
-			*name = substr(t, p - 1);
+			if (name)
+				*name = substr(t, p - 1);
 			t = p;
 			mode++;
 		} else if (mode == 1 && *p == '\n') {
-			*name = substr(t, p);
+			if (name)
+				*name = substr(t, p);
 			p++;
 			break;
 		} else if (mode == 2 && *p == '>') {
-			*email = substr(t, p + 1);
+			if (email)
+				*email = substr(t, p + 1);
 			t = p;
 			mode++;
 		} else if (mode == 2 && *p == '\n') {
-			*email = substr(t, p);
+			if (email)
+				*email = substr(t, p);
 			p++;
 			break;
 		} else if (mode == 3 && isdigit(*p)) {
@@ -115,23 +122,39 @@ const char *reencode(char **txt, const char *src_enc, const char *dst_enc)
 }
 #endif
 
-struct commitinfo *cgit_parse_commit(struct commit *commit)
+/* Parse the commit buffer into a commitinfo struct, but only copy (and
+ * reencode) the fields requested by `fields`, see COMMIT_PARSE_* in
+ * cgit.h. The author and committer dates are always filled in.
+ */
+struct commitinfo *cgit_parse_commit_fields(struct commit *commit, int fields)
 {
 	struct commitinfo *ret;
 	char *p = commit->buffer, *t = commit->buffer;
+	void *data = NULL;
+	enum object_type type;
+	unsigned long size;
+
+	/* Commits filled in from the commit graph have no buffer */
+	if (!p && commit->object.parsed) {
+		data = read_sha1_file(commit->object.sha1, &type, &size);
+		if (data && type == OBJ_COMMIT)
+			p = t = data;
+	}
 
 	ret = xmalloc(sizeof(*ret));
 	ret->commit = commit;
 	ret->author = NULL;
 	ret->author_email = NULL;
+	ret->author_date = 0;
 	ret->committer = NULL;
 	ret->committer_email = NULL;
+	ret->committer_date = 0;
 	ret->subject = NULL;
 	ret->msg = NULL;
 	ret->msg_encoding = NULL;
 
 	if (p == NULL)
-		return ret;
+		goto out;
 
 	if (strncmp(p, "tree ", 5))
 		die("Bad commit: %s", sha1_to_hex(commit->object.sha1));
@@ -142,13 +165,19 @@ struct commitinfo *cgit_parse_commit(struct commit *commit)
 		p += 48; // "parent " + hex[40] + "\n"
 
 	if (p && !strncmp(p, "author ", 7)) {
-		p = parse_user(p + 7, &ret->author, &ret->author_email,
-			&ret->author_date);
+		if (fields & COMMIT_PARSE_AUTHOR)
+			p = parse_user(p + 7, &ret->author, &ret->author_email,
+				&ret->author_date);
+		else
+			p = parse_user(p + 7, NULL, NULL, &ret->author_date);
 	}
 
 	if (p && !strncmp(p, "committer ", 9)) {
-		p = parse_user(p + 9, &ret->committer, &ret->committer_email,
-			&ret->committer_date);
+		if (fields & COMMIT_PARSE_COMMITTER)
+			p = parse_user(p + 9, &ret->committer,
+				&ret->committer_email, &ret->committer_date);
+		else
+			p = parse_user(p + 9, NULL, NULL, &ret->committer_date);
 	}
 
 	if (p && !strncmp(p, "encoding ", 9)) {
@@ -171,12 +200,13 @@ struct commitinfo *cgit_parse_commit(struct commit *commit)
 	while (p && *p == '\n')
 		p++;
 
-	if (!p)
-		return ret;
+	if (!p || !(fields & (COMMIT_PARSE_SUBJECT | COMMIT_PARSE_MSG)))
+		goto out;
 
 	t = strchr(p, '\n');
 	if (t) {
-		ret->subject = substr(p, t);
+		if (fields & COMMIT_PARSE_SUBJECT)
+			ret->subject = substr(p, t);
 		p = t + 1;
 
 		while (p && *p == '\n') {
@@ -184,11 +214,12 @@ struct commitinfo *cgit_parse_commit(struct commit *commit)
 			if (p)
 				p++;
 		}
-		if (p)
+		if (p && (fields & COMMIT_PARSE_MSG))
 			ret->msg = xstrdup(p);
-	} else
+	} else if (fields & COMMIT_PARSE_SUBJECT)
 		ret->subject = xstrdup(p);
 
+out:
 	if (ret->msg_encoding) {
 		reencode(&ret->author, PAGE_ENCODING, ret->msg_encoding);
 		reencode(&ret->author_email, PAGE_ENCODING, ret->msg_encoding);
@@ -197,10 +228,15 @@ struct commitinfo *cgit_parse_commit(struct commit *commit)
 		reencode(&ret->subject, PAGE_ENCODING, ret->msg_encoding);
 		reencode(&ret->msg, PAGE_ENCODING, ret->msg_encoding);
 	}
-
+	free(data);
 	return ret;
 }
 
+struct commitinfo *cgit_parse_commit(struct commit *commit)
+{
+	return cgit_parse_commit_fields(commit, COMMIT_PARSE_ALL);
+}
+
 
 struct taginfo *cgit_parse_tag(struct tag *tag)
 {
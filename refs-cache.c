@@ -0,0 +1,189 @@
+/* refs-cache.c: ref advertisements saved per state of the refs
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * Generating a ref advertisement means resolving and peeling every ref, so
+ * it is saved in the cache root together with a hash of the stat data of
+ * HEAD, packed-refs and every loose ref. A later request only has to stat
+ * those files to find that the saved advertisement is still valid. Git
+ * updates refs by renaming a lock file over them, so every update gives
+ * the file a new inode. HEAD is checked with lstat() so that repointing a
+ * symlinked HEAD counts too.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       2 x uint32: magic, version
+ *   state        sha1 of the stat data of the refs
+ *   content      the advertisement, up to the end of the file
+ */
+
+#include "cgit.h"
+#include "refs-cache.h"
+
+#define REFS_MAGIC    0x43524653 /* "CRFS" */
+#define REFS_VERSION  1
+
+struct refs_header {
+	uint32_t magic;
+	uint32_t version;
+	unsigned char state[20];
+};
+
+static const char *refs_path(const char *name)
+{
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, ctx.repo->path, strlen(ctx.repo->path));
+	git_SHA1_Final(sha1, &c);
+	return fmt("%s/refs-%s-%s", ctx.cfg.cache_root, name,
+		   sha1_to_hex(sha1));
+}
+
+static void hash_stat(git_SHA_CTX *c, const char *path, const struct stat *st,
+		      time_t *modified)
+{
+	uint32_t data[4];
+
+	data[0] = htonl(st->st_ino);
+	data[1] = htonl(st->st_mtime);
+	data[2] = htonl(st->st_ctime);
+	data[3] = htonl(st->st_size);
+	git_SHA1_Update(c, path, strlen(path) + 1);
+	git_SHA1_Update(c, data, sizeof(data));
+	if (st->st_mtime > *modified)
+		*modified = st->st_mtime;
+}
+
+/* Hash the loose refs below `path`. The mtimes of the directories only
+ * count for `modified`, they tell when a ref was last deleted.
+ */
+static void hash_loose_refs(git_SHA_CTX *c, struct strbuf *path,
+			    time_t *modified)
+{
+	size_t len = path->len;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+
+	if (!stat(path->buf, &st) && st.st_mtime > *modified)
+		*modified = st.st_mtime;
+	dir = opendir(path->buf);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", de->d_name);
+		if (lstat(path->buf, &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			hash_loose_refs(c, path, modified);
+		else
+			hash_stat(c, path->buf, &st, modified);
+	}
+	strbuf_setlen(path, len);
+	closedir(dir);
+}
+
+void cgit_refs_state(unsigned char *state, time_t *modified)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	time_t newest = 0;
+	git_SHA_CTX c;
+
+	git_SHA1_Init(&c);
+	if (!lstat(git_path("HEAD"), &st))
+		hash_stat(&c, "HEAD", &st, &newest);
+	if (!stat(git_path("packed-refs"), &st))
+		hash_stat(&c, "packed-refs", &st, &newest);
+	strbuf_addstr(&path, git_path("refs"));
+	hash_loose_refs(&c, &path, &newest);
+	strbuf_release(&path);
+	git_SHA1_Final(state, &c);
+	if (modified)
+		*modified = newest;
+}
+
+/* Append the saved advertisement to `buf`, return 0 on success and -1 if
+ * there is none for `state`.
+ */
+static int read_refs(const char *file, const unsigned char *state,
+		     struct strbuf *buf)
+{
+	const struct refs_header *hdr;
+	char *data;
+	size_t size;
+
+	if (readfile(file, &data, &size))
+		return -1;
+	hdr = (const struct refs_header *)data;
+	if (size < sizeof(*hdr) || ntohl(hdr->magic) != REFS_MAGIC ||
+	    ntohl(hdr->version) != REFS_VERSION ||
+	    hashcmp(hdr->state, state)) {
+		free(data);
+		return -1;
+	}
+	strbuf_add(buf, data + sizeof(*hdr), size - sizeof(*hdr));
+	free(data);
+	return 0;
+}
+
+/* Save the advertisement, return 0 on success and errno otherwise */
+static int write_refs(const char *file, const unsigned char *state,
+		      const char *content, size_t len)
+{
+	struct refs_header hdr;
+	char *lock;
+	int fd, err = 0;
+
+	hdr.magic = htonl(REFS_MAGIC);
+	hdr.version = htonl(REFS_VERSION);
+	hashcpy(hdr.state, state);
+
+	lock = xstrdup(fmt("%s.lock", file));
+	fd = cgit_open_lock(lock);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+	if (write_in_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, content, len) < 0)
+		err = errno;
+	if (!err && rename(lock, file))
+		err = errno;
+	if (err)
+		unlink(lock);
+	close(fd);
+out:
+	free(lock);
+	return err;
+}
+
+int cgit_refs_cache(const char *name, cgit_refs_fill_fn fill,
+		    struct strbuf *buf)
+{
+	unsigned char state[20];
+	size_t len = buf->len;
+	char *file;
+	int err = 0;
+
+	/* The state is taken before generating, so refs changing meanwhile
+	 * make the saved advertisement look older than it is, never newer.
+	 */
+	cgit_refs_state(state, NULL);
+	file = xstrdup(refs_path(name));
+	if (!read_refs(file, state, buf))
+		goto out;
+	err = fill(buf);
+	if (!err && !access(ctx.cfg.cache_root, W_OK))
+		write_refs(file, state, buf->buf + len, buf->len - len);
+out:
+	free(file);
+	return err;
+}
@@ -0,0 +1,21 @@
+#ifndef REFS_CACHE_H
+#define REFS_CACHE_H
+
+#include "cgit.h"
+
+/* Store a hash of the stat data of HEAD and the refs of the current repo in
+ * `state`, and, unless NULL, the time they were last changed in `modified`.
+ */
+extern void cgit_refs_state(unsigned char *state, time_t *modified);
+
+/* Append the output of a ref advertisement to `buf`, return 0 on success */
+typedef int (*cgit_refs_fill_fn)(struct strbuf *buf);
+
+/* Append the ref advertisement `name` of the current repo to `buf`. It is
+ * read from the cache root if it was saved for the current state of the
+ * refs, and generated by `fill` and saved otherwise. Return 0 on success.
+ */
+extern int cgit_refs_cache(const char *name, cgit_refs_fill_fn fill,
+			   struct strbuf *buf);
+
+#endif /* REFS_CACHE_H */
@@ -7,6 +7,10 @@
  */
 
 #include "cgit.h"
+#include <sys/file.h>
+#ifndef NO_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 struct cgit_repolist cgit_repolist;
 struct cgit_context ctx;
@@ -59,7 +63,9 @@ struct cgit_repo *cgit_add_repo(const char *url)
 	ret->enable_log_filecount = ctx.cfg.enable_log_filecount;
 	ret->enable_log_linecount = ctx.cfg.enable_log_linecount;
 	ret->enable_remote_branches = ctx.cfg.enable_remote_branches;
+	ret->enable_smart_http = ctx.cfg.enable_smart_http;
 	ret->enable_subject_links = ctx.cfg.enable_subject_links;
+	ret->enable_tree_lastcommit = ctx.cfg.enable_tree_lastcommit;
 	ret->max_stats = ctx.cfg.max_stats;
 	ret->module_link = ctx.cfg.module_link;
 	ret->readme = NULL;
@@ -173,7 +179,9 @@ struct refinfo *cgit_mk_refinfo(const char *refname, const unsigned char *sha1)
 		ref->tag = cgit_parse_tag((struct tag *)ref->object);
 		break;
 	case OBJ_COMMIT:
-		ref->commit = cgit_parse_commit((struct commit *)ref->object);
+		ref->commit = cgit_parse_commit_fields(
+			(struct commit *)ref->object,
+			COMMIT_PARSE_AUTHOR | COMMIT_PARSE_SUBJECT);
 		break;
 	}
 	return ref;
@@ -261,6 +269,38 @@ int filediff_cb(void *priv, mmbuffer_t *mb, int nbuf)
 	return 0;
 }
 
+static void free_mmfiles(mmfile_t *file1, mmfile_t *file2)
+{
+	if (file1->size)
+		free(file1->ptr);
+	if (file2->size)
+		free(file2->ptr);
+}
+
+/* Load two blobs to be diffed. Return 1 if they could not be loaded, 2 if
+ * either is binary (and then already freed), and 0 otherwise.
+ */
+static int load_mmfiles(mmfile_t *file1, mmfile_t *file2,
+			const unsigned char *old_sha1,
+			const unsigned char *new_sha1,
+			unsigned long *old_size, unsigned long *new_size,
+			int *binary)
+{
+	if (!load_mmfile(file1, old_sha1) || !load_mmfile(file2, new_sha1))
+		return 1;
+
+	*old_size = file1->size;
+	*new_size = file2->size;
+
+	if ((file1->ptr && buffer_is_binary(file1->ptr, file1->size)) ||
+	    (file2->ptr && buffer_is_binary(file2->ptr, file2->size))) {
+		*binary = 1;
+		free_mmfiles(file1, file2);
+		return 2;
+	}
+	return 0;
+}
+
 int cgit_diff_files(const unsigned char *old_sha1,
 		    const unsigned char *new_sha1, unsigned long *old_size,
 		    unsigned long *new_size, int *binary, int context,
@@ -271,19 +311,11 @@ int cgit_diff_files(const unsigned char *old_sha1,
 	xdemitconf_t emit_params;
 	xdemitcb_t emit_cb;
 
-	if (!load_mmfile(&file1, old_sha1) || !load_mmfile(&file2, new_sha1))
+	switch (load_mmfiles(&file1, &file2, old_sha1, new_sha1, old_size,
+			     new_size, binary)) {
+	case 1:
 		return 1;
-
-	*old_size = file1.size;
-	*new_size = file2.size;
-
-	if ((file1.ptr && buffer_is_binary(file1.ptr, file1.size)) ||
-	    (file2.ptr && buffer_is_binary(file2.ptr, file2.size))) {
-		*binary = 1;
-		if (file1.size)
-			free(file1.ptr);
-		if (file2.size)
-			free(file2.ptr);
+	case 2:
 		return 0;
 	}
 
@@ -298,10 +330,64 @@ int cgit_diff_files(const unsigned char *old_sha1,
 	emit_cb.outf = filediff_cb;
 	emit_cb.priv = fn;
 	xdl_diff(&file1, &file2, &diff_params, &emit_params, &emit_cb);
-	if (file1.size)
-		free(file1.ptr);
-	if (file2.size)
-		free(file2.ptr);
+	free_mmfiles(&file1, &file2);
+	return 0;
+}
+
+/*
+ * Count the changed lines as xdiff emits them. Without context, every
+ * record is either a hunk header (a single buffer) or a changed line,
+ * emitted as the prefix followed by the line itself.
+ */
+static int count_lines_cb(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	int *counts = priv;
+
+	if (nbuf < 2 || mb[0].size != 1)
+		return 0;
+	if (mb[0].ptr[0] == '+')
+		counts[0]++;
+	else if (mb[0].ptr[0] == '-')
+		counts[1]++;
+	return 0;
+}
+
+/*
+ * Like cgit_diff_files(), but only count the added and removed lines.
+ * This skips the minimal diff search, context and function names, and
+ * the reassembly of the output into lines.
+ */
+int cgit_diff_files_count(const unsigned char *old_sha1,
+			  const unsigned char *new_sha1,
+			  unsigned long *old_size, unsigned long *new_size,
+			  int *binary, int ignorews, int *added, int *removed)
+{
+	mmfile_t file1, file2;
+	xpparam_t diff_params;
+	xdemitconf_t emit_params;
+	xdemitcb_t emit_cb;
+	int counts[2] = {0, 0};
+
+	*added = *removed = 0;
+	switch (load_mmfiles(&file1, &file2, old_sha1, new_sha1, old_size,
+			     new_size, binary)) {
+	case 1:
+		return 1;
+	case 2:
+		return 0;
+	}
+
+	memset(&diff_params, 0, sizeof(diff_params));
+	memset(&emit_params, 0, sizeof(emit_params));
+	memset(&emit_cb, 0, sizeof(emit_cb));
+	if (ignorews)
+		diff_params.flags |= XDF_IGNORE_WHITESPACE;
+	emit_cb.outf = count_lines_cb;
+	emit_cb.priv = counts;
+	xdl_diff(&file1, &file2, &diff_params, &emit_params, &emit_cb);
+	free_mmfiles(&file1, &file2);
+	*added = counts[0];
+	*removed = counts[1];
 	return 0;
 }
 
@@ -410,6 +496,155 @@ int cgit_close_filter(struct cgit_filter *filter)
 	die("Subprocess %s exited abnormally", filter->cmd);
 }
 
+#ifndef NO_SENDFILE
+/* Let the kernel copy the range without passing it through userspace,
+ * return 0 when done, 1 if `fd` is an output sendfile() cannot write to,
+ * and -1 on errors. `ofs` and `len` are updated with what was sent.
+ */
+static int sendfile_range(int fd, int src, unsigned long *ofs,
+			  unsigned long *len)
+{
+	off_t pos = *ofs;
+	ssize_t n;
+
+	while (*len) {
+		n = sendfile(fd, src, &pos, *len < 0x40000000 ? *len : 0x40000000);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+			return 1;
+		if (n <= 0)
+			return -1;
+		*ofs += n;
+		*len -= n;
+	}
+	return 0;
+}
+#endif
+
+/* Copy `len` bytes from offset `ofs` of the file `src` to `fd`, return 0
+ * on success.
+ */
+int cgit_sendfile(int fd, int src, unsigned long ofs, unsigned long len)
+{
+	char buf[65536];
+	ssize_t n;
+
+#ifndef NO_SENDFILE
+	n = sendfile_range(fd, src, &ofs, &len);
+	if (n <= 0)
+		return n;
+#endif
+	while (len) {
+		n = pread(src, buf, len < sizeof(buf) ? len : sizeof(buf), ofs);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0 || write_in_full(fd, buf, n) < 0)
+			return -1;
+		ofs += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Open and lock the lock file `lock` of one of the caches below cache-root.
+ * The lock is an flock() on the file, so a lock file left behind by a
+ * process which died holding it can be taken over safely; there is no
+ * need to guess from its age whether its owner is still alive. The owner
+ * must rename or unlink the file before closing it. Return the descriptor
+ * of the empty lock file, or -1 with errno set to EEXIST if the lock is
+ * held by someone else.
+ */
+int cgit_open_lock(const char *lock)
+{
+	struct stat st, cur;
+	int fd;
+
+	for (;;) {
+		fd = open(lock, O_WRONLY | O_CREAT, 0666);
+		if (fd < 0)
+			return -1;
+		if (flock(fd, LOCK_EX | LOCK_NB)) {
+			close(fd);
+			errno = EEXIST;
+			return -1;
+		}
+		/* The previous owner may have released the file between
+		 * open() and flock(), then it is no longer the lock file.
+		 */
+		if (!fstat(fd, &st) && !stat(lock, &cur) &&
+		    st.st_dev == cur.st_dev && st.st_ino == cur.st_ino)
+			break;
+		close(fd);
+	}
+	if (ftruncate(fd, 0)) {
+		close(fd);
+		unlink(lock);
+		return -1;
+	}
+	return fd;
+}
+
+struct cache_file {
+	char *name;
+	off_t size;
+	time_t mtime;
+};
+
+static int cmp_cache_files(const void *a, const void *b)
+{
+	const struct cache_file *f1 = a, *f2 = b;
+
+	if (f1->mtime != f2->mtime)
+		return f1->mtime < f2->mtime ? -1 : 1;
+	return strcmp(f1->name, f2->name);
+}
+
+/* Remove the files named `prefix`* in cache-root with the oldest mtime,
+ * until the size of the rest is at most `budget`. Lock files are left
+ * alone. Caches which want the least recently used files to go first
+ * update the mtime on every hit.
+ */
+void cgit_evict_cache_files(const char *prefix, off_t budget)
+{
+	struct cache_file *files = NULL;
+	int i, nr = 0, alloc = 0;
+	off_t total = 0;
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	DIR *dir;
+
+	dir = opendir(ctx.cfg.cache_root);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (prefixcmp(de->d_name, prefix) ||
+		    strchr(de->d_name, '.'))
+			continue;
+		path = xstrdup(fmt("%s/%s", ctx.cfg.cache_root, de->d_name));
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(files, nr + 1, alloc);
+		files[nr].name = path;
+		files[nr].size = st.st_size;
+		files[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(files, nr, sizeof(*files), cmp_cache_files);
+	for (i = 0; i < nr; i++) {
+		if (total > budget && !unlink(files[i].name))
+			total -= files[i].size;
+		free(files[i].name);
+	}
+	free(files);
+}
+
 /* Read the content of the specified file into a newly allocated buffer,
  * zeroterminate the buffer and return 0 on success, errno otherwise.
  */
@@ -0,0 +1,146 @@
+/* snapshot-cache.c: snapshot archives saved for later downloads
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * An archive is saved in the cache root in a file named after a hash of
+ * everything its content depends on: the tree, the prefix, the commit time
+ * given to the entries, the format and the compression level. Downloads of
+ * the same archive, from any ref or repo, are sent from that file.
+ *
+ * The archive is written to a lock file, which is renamed when complete.
+ * Requests for an archive being written wait for the lock to go away
+ * instead of generating it once more, until the lock is released by the
+ * writer, even if it died (see cgit_open_lock()).
+ *
+ * The total size of the archives is kept below snapshot-cache-size by
+ * removing the ones least recently sent, whose mtime is set on every hit.
+ *
+ * A HEAD request is answered from a saved archive if there is one, but
+ * never generates it just to tell its size.
+ */
+
+#include "cgit.h"
+#include "html.h"
+#include "ui-shared.h"
+#include "snapshot-cache.h"
+#include <utime.h>
+
+#define SNAPSHOT_POLL     100000 /* usecs */
+
+static const char *snapshot_path(const struct cgit_snapshot_format *format,
+				 const struct archiver_args *args)
+{
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+	const char *p;
+
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, args->tree->object.sha1, 20);
+	git_SHA1_Update(&c, args->base, args->baselen + 1);
+	git_SHA1_Update(&c, format->suffix, strlen(format->suffix) + 1);
+	p = fmt("%d %lu", args->compression_level, (unsigned long)args->time);
+	git_SHA1_Update(&c, p, strlen(p) + 1);
+	git_SHA1_Final(sha1, &c);
+	return fmt("%s/snapshot-%s", ctx.cfg.cache_root, sha1_to_hex(sha1));
+}
+
+/* Write the archive to `fd`, return 0 on success */
+static int write_snapshot(int fd, const struct cgit_snapshot_format *format,
+			  struct archiver_args *args)
+{
+	int old_stdout, err;
+
+	/* The archivers and the compression filters write to stdout */
+	old_stdout = dup(STDOUT_FILENO);
+	if (old_stdout < 0)
+		return -1;
+	if (dup2(fd, STDOUT_FILENO) < 0) {
+		close(old_stdout);
+		return -1;
+	}
+	err = format->write_func(args);
+	chk_non_negative(dup2(old_stdout, STDOUT_FILENO),
+			 "Unable to restore STDOUT");
+	close(old_stdout);
+	return err;
+}
+
+/* Open the archive `file`, generating it unless another process already
+ * is. Return the file descriptor, or -1 on errors.
+ */
+static int open_snapshot(const char *file,
+			 const struct cgit_snapshot_format *format,
+			 struct archiver_args *args)
+{
+	char *lock;
+	int fd, err;
+
+	fd = open(file, O_RDONLY);
+	if (fd >= 0)
+		return fd;
+	lock = xstrdup(fmt("%s.lock", file));
+	while ((fd = cgit_open_lock(lock)) < 0) {
+		if (errno != EEXIST)
+			goto out;
+		usleep(SNAPSHOT_POLL);
+		fd = open(file, O_RDONLY);
+		if (fd >= 0)
+			goto out;
+	}
+	err = write_snapshot(fd, format, args);
+	if (err || rename(lock, file)) {
+		unlink(lock);
+		close(fd);
+		fd = -1;
+		goto out;
+	}
+	close(fd);
+	fd = open(file, O_RDONLY);
+	cgit_evict_cache_files("snapshot-",
+			       (off_t)ctx.cfg.snapshot_cache_size * 1024 * 1024);
+out:
+	free(lock);
+	return fd;
+}
+
+static int send_snapshot_range(void *data, int fd, unsigned long ofs,
+			       unsigned long len)
+{
+	return cgit_sendfile(fd, *(int *)data, ofs, len);
+}
+
+int cgit_snapshot_cache_enabled(void)
+{
+	return ctx.cfg.snapshot_cache_size > 0 && ctx.cfg.cache_root &&
+		!access(ctx.cfg.cache_root, W_OK);
+}
+
+int cgit_print_cached_snapshot(const struct cgit_snapshot_format *format,
+			       struct archiver_args *args)
+{
+	struct stat st;
+	char *file;
+	int fd;
+
+	if (!cgit_snapshot_cache_enabled())
+		return -1;
+	file = xstrdup(snapshot_path(format, args));
+	if (ctx.env.request_method && !strcmp(ctx.env.request_method, "HEAD"))
+		fd = open(file, O_RDONLY);
+	else
+		fd = open_snapshot(file, format, args);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
+		free(file);
+		return -1;
+	}
+	utime(file, NULL);
+	ctx.page.size = st.st_size;
+	cgit_print_http_ranged(&ctx, send_snapshot_range, &fd);
+	close(fd);
+	free(file);
+	return 0;
+}
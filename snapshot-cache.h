@@ -0,0 +1,17 @@
+#ifndef SNAPSHOT_CACHE_H
+#define SNAPSHOT_CACHE_H
+
+#include "cgit.h"
+
+/* Return 1 if snapshots are saved in the snapshot cache */
+extern int cgit_snapshot_cache_enabled(void);
+
+/* Print the headers and the archive `format` of `args`, taken from the
+ * snapshot cache and generated into it first if needed. Return 0 if the
+ * snapshot was printed, and -1 if the caller has to generate it, with
+ * nothing printed. HEAD requests are only answered from a saved archive.
+ */
+extern int cgit_print_cached_snapshot(const struct cgit_snapshot_format *format,
+				      struct archiver_args *args);
+
+#endif /* SNAPSHOT_CACHE_H */
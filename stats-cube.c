@@ -0,0 +1,481 @@
+/* stats-cube.c: incrementally updated commit counts for the stats page
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * A stats cube holds the number of non-merge commits per author per day
+ * reachable from the tip of a branch. It is saved in the cache root, in a
+ * file named after a hash of the repository path and branch name, and is
+ * extended by walking only the commits between the saved tip and the
+ * current one. If the branch was rewritten, the cube is rebuilt. Only
+ * branches get a cube; the stats of other revisions are computed by
+ * walking the commits every time. The cubes used least recently are
+ * removed once all cubes take more than CUBE_BUDGET bytes.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       4 x uint32: magic, version, number of cells, number of
+ *                authors
+ *   tip          sha1 of the commit the cube was computed for
+ *   cells        3 x uint32 per cell: day, author number, commit count,
+ *                sorted by day and author number
+ *   key          NUL-terminated repository path and branch name
+ *   authors      one NUL-terminated name per author
+ */
+
+#include "cgit.h"
+#include "cache.h"
+#include "stats-cube.h"
+#include <utime.h>
+
+#define CUBE_MAGIC    0x43535443 /* "CSTC" */
+#define CUBE_VERSION  1
+#define CUBE_DAY_SECS (60 * 60 * 24)
+#define CUBE_MIN_JOB_COMMITS 1024
+#define CUBE_BUDGET   (64 * 1024 * 1024)
+
+struct cube_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr_cells;
+	uint32_t nr_authors;
+	unsigned char tip[20];
+};
+
+static const char *cube_key(const char *head)
+{
+	return fmt("%s%c%s", ctx.repo->path, '\0', head);
+}
+
+static const char *cube_path(const char *head)
+{
+	return fmt("%s/stats-%08lx", ctx.cfg.cache_root,
+		   hash_str(fmt("%s/%s", ctx.repo->path, head)));
+}
+
+void cgit_free_stats_cube(struct stats_cube *cube)
+{
+	int i;
+
+	for (i = 0; i < cube->authors_nr; i++)
+		free(cube->authors[i]);
+	free(cube->authors);
+	free(cube->cells);
+	memset(cube, 0, sizeof(*cube));
+}
+
+/* Read the saved cube for `head`, return 0 on success and -1 if there is
+ * no valid cube.
+ */
+static int read_cube(const char *head, struct stats_cube *cube)
+{
+	const struct cube_header *hdr;
+	const uint32_t *cell;
+	const char *key, *p, *end;
+	char *buf;
+	size_t size, keylen;
+	uint32_t nr_cells, nr_authors, i;
+
+	if (readfile(cube_path(head), &buf, &size))
+		return -1;
+	hdr = (const struct cube_header *)buf;
+	if (size < sizeof(*hdr) || ntohl(hdr->magic) != CUBE_MAGIC ||
+	    ntohl(hdr->version) != CUBE_VERSION)
+		goto fail;
+	nr_cells = ntohl(hdr->nr_cells);
+	nr_authors = ntohl(hdr->nr_authors);
+	if ((size - sizeof(*hdr)) / 12 < nr_cells)
+		goto fail;
+
+	/* Ignore cubes of other repositories with the same file name */
+	p = buf + sizeof(*hdr) + (size_t)nr_cells * 12;
+	end = buf + size;
+	key = cube_key(head);
+	keylen = strlen(ctx.repo->path) + strlen(head) + 2;
+	if (end - p < keylen || memcmp(p, key, keylen))
+		goto fail;
+	p += keylen;
+
+	hashcpy(cube->tip, hdr->tip);
+	ALLOC_GROW(cube->authors, nr_authors, cube->authors_alloc);
+	for (i = 0; i < nr_authors; i++) {
+		if (!memchr(p, '\0', end - p))
+			goto fail;
+		cube->authors[cube->authors_nr++] = xstrdup(p);
+		p += strlen(p) + 1;
+	}
+	ALLOC_GROW(cube->cells, nr_cells, cube->cells_alloc);
+	cell = (const uint32_t *)(hdr + 1);
+	for (i = 0; i < nr_cells; i++, cell += 3) {
+		cube->cells[i].day = ntohl(cell[0]);
+		cube->cells[i].author = ntohl(cell[1]);
+		cube->cells[i].count = ntohl(cell[2]);
+		if (cube->cells[i].author >= nr_authors)
+			goto fail;
+	}
+	cube->cells_nr = nr_cells;
+	free(buf);
+	return 0;
+fail:
+	free(buf);
+	cgit_free_stats_cube(cube);
+	return -1;
+}
+
+/* Save the cube, return 0 on success and errno otherwise */
+static int write_cube(const char *head, struct stats_cube *cube)
+{
+	struct cube_header hdr;
+	struct strbuf sb = STRBUF_INIT;
+	uint32_t cell[3];
+	char *path, *lock;
+	int fd, i, err = 0;
+
+	hdr.magic = htonl(CUBE_MAGIC);
+	hdr.version = htonl(CUBE_VERSION);
+	hdr.nr_cells = htonl(cube->cells_nr);
+	hdr.nr_authors = htonl(cube->authors_nr);
+	hashcpy(hdr.tip, cube->tip);
+	strbuf_add(&sb, &hdr, sizeof(hdr));
+	for (i = 0; i < cube->cells_nr; i++) {
+		cell[0] = htonl(cube->cells[i].day);
+		cell[1] = htonl(cube->cells[i].author);
+		cell[2] = htonl(cube->cells[i].count);
+		strbuf_add(&sb, cell, sizeof(cell));
+	}
+	strbuf_add(&sb, cube_key(head),
+		   strlen(ctx.repo->path) + strlen(head) + 2);
+	for (i = 0; i < cube->authors_nr; i++)
+		strbuf_add(&sb, cube->authors[i], strlen(cube->authors[i]) + 1);
+
+	path = xstrdup(cube_path(head));
+	lock = xstrdup(fmt("%s.lock", path));
+	fd = cgit_open_lock(lock);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+	if (write_in_full(fd, sb.buf, sb.len) < 0)
+		err = errno;
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	close(fd);
+out:
+	free(lock);
+	free(path);
+	strbuf_release(&sb);
+	return err;
+}
+
+static int cmp_cells(const void *a, const void *b)
+{
+	const struct stats_cell *c1 = a, *c2 = b;
+
+	if (c1->day != c2->day)
+		return c1->day < c2->day ? -1 : 1;
+	if (c1->author != c2->author)
+		return c1->author < c2->author ? -1 : 1;
+	return 0;
+}
+
+/* Sort the cells and merge the ones for the same day and author */
+static void merge_cells(struct stats_cube *cube)
+{
+	int i, n = 0;
+
+	qsort(cube->cells, cube->cells_nr, sizeof(struct stats_cell),
+	      cmp_cells);
+	for (i = 0; i < cube->cells_nr; i++) {
+		if (n && !cmp_cells(&cube->cells[n - 1], &cube->cells[i]))
+			cube->cells[n - 1].count += cube->cells[i].count;
+		else
+			cube->cells[n++] = cube->cells[i];
+	}
+	cube->cells_nr = n;
+}
+
+static void init_ids(struct stats_cube *cube, struct string_list *ids)
+{
+	int i;
+
+	memset(ids, 0, sizeof(*ids));
+	ids->strdup_strings = 1;
+	for (i = 0; i < cube->authors_nr; i++)
+		string_list_insert(ids, cube->authors[i])->util =
+			(void *)(intptr_t)(i + 1);
+}
+
+static uint32_t add_author(struct stats_cube *cube, struct string_list *ids,
+			   const char *name)
+{
+	struct string_list_item *item;
+
+	item = string_list_insert(ids, name);
+	if (!item->util) {
+		ALLOC_GROW(cube->authors, cube->authors_nr + 1,
+			   cube->authors_alloc);
+		cube->authors[cube->authors_nr++] = xstrdup(name);
+		item->util = (void *)(intptr_t)cube->authors_nr;
+	}
+	return (intptr_t)item->util - 1;
+}
+
+static void add_cell(struct stats_cube *cube, uint32_t day, uint32_t author,
+		     uint32_t count)
+{
+	struct stats_cell *cell;
+
+	ALLOC_GROW(cube->cells, cube->cells_nr + 1, cube->cells_alloc);
+	cell = &cube->cells[cube->cells_nr++];
+	cell->day = day;
+	cell->author = author;
+	cell->count = count;
+}
+
+static void count_commits(struct stats_cube *cube, struct string_list *ids,
+			  struct commit **commits, int nr)
+{
+	struct commitinfo *info;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		info = cgit_parse_commit_fields(commits[i],
+						COMMIT_PARSE_AUTHOR);
+		add_cell(cube, commits[i]->date / CUBE_DAY_SECS,
+			 add_author(cube, ids, info->author ? info->author : ""),
+			 1);
+		cgit_free_commitinfo(info);
+	}
+}
+
+/* A worker counts its share of the commits into a cube of its own and
+ * sends it to the parent: the number of authors, cells and bytes of
+ * author names, followed by the cells and the NUL-terminated names.
+ */
+static void run_worker(int fd, struct commit **commits, int nr)
+{
+	struct stats_cube cube;
+	struct string_list ids;
+	struct strbuf names = STRBUF_INIT;
+	uint32_t hdr[3];
+	int i;
+
+	memset(&cube, 0, sizeof(cube));
+	init_ids(&cube, &ids);
+	count_commits(&cube, &ids, commits, nr);
+	merge_cells(&cube);
+	for (i = 0; i < cube.authors_nr; i++)
+		strbuf_add(&names, cube.authors[i],
+			   strlen(cube.authors[i]) + 1);
+	hdr[0] = cube.authors_nr;
+	hdr[1] = cube.cells_nr;
+	hdr[2] = names.len;
+	if (write_in_full(fd, hdr, sizeof(hdr)) < 0 ||
+	    write_in_full(fd, cube.cells,
+			  cube.cells_nr * sizeof(struct stats_cell)) < 0 ||
+	    write_in_full(fd, names.buf, names.len) < 0)
+		_exit(1);
+	_exit(0);
+}
+
+/* Merge the cube sent by a worker, return 0 on success */
+static int read_worker(int fd, struct stats_cube *cube,
+		       struct string_list *ids)
+{
+	struct stats_cell *cells = NULL;
+	uint32_t hdr[3], *map = NULL, i;
+	char *names = NULL, *p;
+	int err = -1;
+
+	if (read_in_full(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+	cells = xmalloc(hdr[1] * sizeof(struct stats_cell) + 1);
+	names = xmalloc(hdr[2] + 1);
+	map = xmalloc(hdr[0] * sizeof(uint32_t) + 1);
+	if (read_in_full(fd, cells, hdr[1] * sizeof(struct stats_cell)) !=
+	    hdr[1] * sizeof(struct stats_cell) ||
+	    read_in_full(fd, names, hdr[2]) != hdr[2])
+		goto out;
+	names[hdr[2]] = '\0';
+	for (i = 0, p = names; i < hdr[0]; i++, p += strlen(p) + 1) {
+		if (p >= names + hdr[2])
+			goto out;
+		map[i] = add_author(cube, ids, p);
+	}
+	for (i = 0; i < hdr[1]; i++)
+		if (cells[i].author < hdr[0])
+			add_cell(cube, cells[i].day, map[cells[i].author],
+				 cells[i].count);
+	err = 0;
+out:
+	free(map);
+	free(names);
+	free(cells);
+	return err;
+}
+
+struct stats_worker {
+	pid_t pid;
+	int fd;
+	int first;
+	int nr;
+};
+
+/* Count the commits by author and day into the cube. As the object store
+ * is not thread-safe, the commits are split between up to `stats-jobs`
+ * worker processes, each reading its own commits. The share of a worker
+ * which could not be started or failed is counted by the caller.
+ */
+void cgit_stats_cube_add_commits(struct stats_cube *cube,
+				 struct commit **commits, int nr)
+{
+	struct stats_worker *workers;
+	struct string_list ids;
+	int jobs, i, fd[2], status, err;
+
+	init_ids(cube, &ids);
+	jobs = ctx.cfg.stats_jobs;
+	if (jobs > nr / CUBE_MIN_JOB_COMMITS)
+		jobs = nr / CUBE_MIN_JOB_COMMITS;
+	if (jobs <= 1) {
+		count_commits(cube, &ids, commits, nr);
+		goto out;
+	}
+
+	fflush(stdout);
+	workers = xcalloc(jobs, sizeof(*workers));
+	for (i = 0; i < jobs; i++) {
+		workers[i].first = (long long)nr * i / jobs;
+		workers[i].nr = (long long)nr * (i + 1) / jobs - workers[i].first;
+		workers[i].pid = -1;
+		if (pipe(fd))
+			continue;
+		workers[i].pid = fork();
+		if (workers[i].pid == 0) {
+			close(fd[0]);
+			run_worker(fd[1], commits + workers[i].first,
+				   workers[i].nr);
+		}
+		close(fd[1]);
+		workers[i].fd = fd[0];
+		if (workers[i].pid < 0)
+			close(fd[0]);
+	}
+	for (i = 0; i < jobs; i++) {
+		if (workers[i].pid > 0) {
+			err = read_worker(workers[i].fd, cube, &ids);
+			close(workers[i].fd);
+			if (waitpid(workers[i].pid, &status, 0) < 0 ||
+			    !WIFEXITED(status) || WEXITSTATUS(status))
+				err = -1;
+			if (!err)
+				continue;
+		}
+		count_commits(cube, &ids, commits + workers[i].first,
+			      workers[i].nr);
+	}
+	free(workers);
+out:
+	string_list_clear(&ids, 0);
+	merge_cells(cube);
+}
+
+/* Add the non-merge commits reachable from `tip` but not from `old` */
+static void walk_commits(struct stats_cube *cube, struct commit *tip,
+			 struct commit *old)
+{
+	struct rev_info rev;
+	struct commit *commit, **commits = NULL;
+	const char *argv[] = {NULL, NULL, NULL, NULL};
+	int nr = 0, alloc = 0;
+
+	argv[1] = xstrdup(sha1_to_hex(tip->object.sha1));
+	if (old)
+		argv[2] = xstrdup(fmt("^%s", sha1_to_hex(old->object.sha1)));
+	init_revisions(&rev, NULL);
+	rev.no_merges = 1;
+	setup_revisions(old ? 3 : 2, argv, &rev, NULL);
+	prepare_revision_walk(&rev);
+	while ((commit = get_revision(&rev)) != NULL) {
+		free(commit->buffer);
+		commit->buffer = NULL;
+		ALLOC_GROW(commits, nr + 1, alloc);
+		commits[nr++] = commit;
+	}
+	cgit_stats_cube_add_commits(cube, commits, nr);
+	clear_commit_marks(tip, ALL_REV_FLAGS);
+	if (old)
+		clear_commit_marks(old, ALL_REV_FLAGS);
+	free(commits);
+	free((char *)argv[1]);
+	free((char *)argv[2]);
+}
+
+/* Bring the cube of the branch `head` up to date and save it. Return 0 on
+ * success, -1 if `head` is not a branch and errno if the cube could not be
+ * saved.
+ */
+static int update_cube(const char *head, struct stats_cube *cube)
+{
+	unsigned char sha1[20];
+	struct commit *tip, *old = NULL;
+	int err;
+
+	memset(cube, 0, sizeof(*cube));
+	if (!prefixcmp(head, "refs/heads/"))
+		head += 11;
+	if (!resolve_ref(fmt("refs/heads/%s", head), sha1, 1, NULL))
+		return -1;
+	tip = lookup_commit_reference_gently(sha1, 1);
+	if (!tip || parse_commit(tip))
+		return -1;
+	if (!read_cube(head, cube)) {
+		if (!hashcmp(cube->tip, tip->object.sha1)) {
+			utime(cube_path(head), NULL);
+			return 0;
+		}
+		old = lookup_commit_reference_gently(cube->tip, 1);
+		if (!old || parse_commit(old) || !in_merge_bases(old, &tip, 1)) {
+			cgit_free_stats_cube(cube);
+			old = NULL;
+		}
+	}
+	walk_commits(cube, tip, old);
+	hashcpy(cube->tip, tip->object.sha1);
+	err = write_cube(head, cube);
+	if (!err)
+		cgit_evict_cache_files("stats-", CUBE_BUDGET);
+	return err;
+}
+
+int cgit_load_stats_cube(const char *head, struct stats_cube *cube)
+{
+	return update_cube(head, cube) < 0 ? -1 : 0;
+}
+
+static int stats_branch_cb(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	struct stats_cube cube;
+	int *err = cb_data;
+	int e;
+
+	e = update_cube(refname, &cube);
+	if (e > 0 && !*err)
+		*err = e;
+	cgit_free_stats_cube(&cube);
+	return 0;
+}
+
+int cgit_write_stats_cubes(void)
+{
+	int err = 0;
+
+	if (access(ctx.cfg.cache_root, W_OK))
+		return errno;
+	for_each_branch_ref(stats_branch_cb, &err);
+	return err;
+}
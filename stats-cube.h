@@ -0,0 +1,41 @@
+#ifndef STATS_CUBE_H
+#define STATS_CUBE_H
+
+#include "cgit.h"
+
+/* The number of non-merge commits by one author on one day */
+struct stats_cell {
+	uint32_t day;
+	uint32_t author;
+	uint32_t count;
+};
+
+/* Commit counts per author per day (since the epoch) for all non-merge
+ * commits reachable from `tip`, with the cells sorted by day and author.
+ */
+struct stats_cube {
+	unsigned char tip[20];
+	char **authors;
+	int authors_nr;
+	int authors_alloc;
+	struct stats_cell *cells;
+	int cells_nr;
+	int cells_alloc;
+};
+
+/* Load the cached cube for the branch `head` in the current repository and
+ * bring it up to date with the tip of `head`, walking only the commits
+ * added since the cube was saved. Return 0 on success, or -1 if `head` is
+ * not a branch.
+ */
+extern int cgit_load_stats_cube(const char *head, struct stats_cube *cube);
+extern void cgit_free_stats_cube(struct stats_cube *cube);
+
+/* Count `commits` into the cube, in parallel if "stats-jobs" allows */
+extern void cgit_stats_cube_add_commits(struct stats_cube *cube,
+					struct commit **commits, int nr);
+
+/* Update the cached cubes of all branches of the current repository */
+extern int cgit_write_stats_cubes(void);
+
+#endif /* STATS_CUBE_H */
@@ -30,4 +30,81 @@ run_test 'verify a+b?h=1+2 link' '
 	grep -e "/foo+bar/tree/a+b?h=1%2b2" trash/tmp
 '
 
+run_test 'generate bar/tree with last commits' '
+	echo "enable-tree-lastcommit=1" >trash/cgitrc.lastcommit &&
+	cat trash/cgitrc >>trash/cgitrc.lastcommit &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.lastcommit" QUERY_STRING="url=bar/tree" \
+		"$PWD/../cgit" >trash/tmp
+'
+
+run_test 'find last commit of file-7' '
+	grep -e "file-7</a></td><td class=.ls-size.>2</td><td class=.ls-commit.><a [^>]*>commit 7</a>" trash/tmp
+'
+
+run_test 'find cached last commit of file-7' '
+	ls trash/cache/blame-* &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.lastcommit" QUERY_STRING="url=bar/tree" \
+		"$PWD/../cgit" >trash/tmp &&
+	grep -e "file-7</a></td><td class=.ls-size.>2</td><td class=.ls-commit.><a [^>]*>commit 7</a>" trash/tmp
+'
+
+run_test 'save no last commits without the cache' '
+	cat trash/cgitrc.lastcommit >trash/cgitrc.nocache &&
+	echo "cache-size=0" >>trash/cgitrc.nocache &&
+	rm -f trash/cache/blame-* &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.nocache" QUERY_STRING="url=bar/tree" \
+		"$PWD/../cgit" >trash/tmp &&
+	grep -e "file-7</a></td><td class=.ls-size.>2</td><td class=.ls-commit.><a [^>]*>commit 7</a>" trash/tmp &&
+	! ls trash/cache/blame-*
+'
+
+# The merge takes "a" from master and "b" from side, which changed both
+# after master changed "a"
+mkmergerepo()
+{
+	dir=$PWD
+	mkdir -p trash/repos/merge && cd trash/repos/merge && git init &&
+	echo base >a && echo base >b && git add a b &&
+	GIT_AUTHOR_DATE="1000000000 +0000" GIT_COMMITTER_DATE="1000000000 +0000" \
+		git commit -m "base" &&
+	git checkout -b side &&
+	echo side >a && echo side >b &&
+	GIT_AUTHOR_DATE="1000000200 +0000" GIT_COMMITTER_DATE="1000000200 +0000" \
+		git commit -a -m "side change" &&
+	git checkout - &&
+	echo main >a &&
+	GIT_AUTHOR_DATE="1000000100 +0000" GIT_COMMITTER_DATE="1000000100 +0000" \
+		git commit -a -m "main change"
+	git merge side
+	echo main >a && git add a &&
+	GIT_AUTHOR_DATE="1000000300 +0000" GIT_COMMITTER_DATE="1000000300 +0000" \
+		git commit -m "merge side"
+	res=$?
+	cd $dir
+	return $res
+}
+
+cat >>trash/cgitrc.lastcommit <<EOF
+
+repo.url=merge
+repo.path=$PWD/trash/repos/merge/.git
+EOF
+
+run_test 'create repo with a merge' '
+	test -d trash/repos/merge || mkmergerepo >/dev/null 2>&1
+'
+
+run_test 'generate merge/tree with last commits' '
+	CGIT_CONFIG="$PWD/trash/cgitrc.lastcommit" QUERY_STRING="url=merge/tree" \
+		"$PWD/../cgit" >trash/tmp
+'
+
+run_test 'find last commit of a taken from master' '
+	grep -e ">a</a></td><td class=.ls-size.>5</td><td class=.ls-commit.><a [^>]*>main change</a>" trash/tmp
+'
+
+run_test 'find last commit of b taken from side' '
+	grep -e ">b</a></td><td class=.ls-size.>5</td><td class=.ls-commit.><a [^>]*>side change</a>" trash/tmp
+'
+
 tests_done
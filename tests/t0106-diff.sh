@@ -17,4 +17,21 @@ run_test 'find added line' '
 	grep -e "<div class=.add.>+5</div>" trash/tmp
 '
 
+run_test 'generate foo/diff with a line budget' '
+	echo "max-diff-lines=1" >trash/cgitrc.limited &&
+	cat trash/cgitrc >>trash/cgitrc.limited &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.limited" QUERY_STRING="url=foo/diff" \
+		"$PWD/../cgit" >trash/tmp &&
+	grep -e "Diff truncated (too many lines)" trash/tmp &&
+	grep -e "<a href=./foo/diff/file-5.>show the diff of this file" trash/tmp &&
+	! grep -e "<div class=.add.>+5</div>" trash/tmp
+'
+
+run_test 'generate foo/diff/file-5 with a line budget' '
+	CGIT_CONFIG="$PWD/trash/cgitrc.limited" QUERY_STRING="url=foo/diff/file-5" \
+		"$PWD/../cgit" >trash/tmp &&
+	grep -e "<div class=.add.>+5</div>" trash/tmp &&
+	! grep -e "Diff truncated" trash/tmp
+'
+
 tests_done
@@ -36,4 +36,53 @@ run_test 'verify untarred file-5' '
 	 test $(cat trash/master/file-5 | wc -l) = 1
 '
 
+run_test 'save a snapshot in the snapshot cache' '
+	cat trash/cgitrc >trash/cgitrc.snapshots &&
+	echo "cache-size=0" >>trash/cgitrc.snapshots &&
+	echo "snapshot-cache-size=1" >>trash/cgitrc.snapshots &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.snapshots" \
+		QUERY_STRING="url=foo/snapshot/master.tar" \
+		"$PWD/../cgit" >trash/tmp &&
+	test $(ls -1 trash/cache/snapshot-* | wc -l) = 1 &&
+	grep -a -e "^Accept-Ranges: bytes" trash/tmp
+'
+
+run_test 'send a snapshot from the snapshot cache' '
+	CGIT_CONFIG="$PWD/trash/cgitrc.snapshots" \
+		QUERY_STRING="url=foo/snapshot/master.tar" \
+		"$PWD/../cgit" >trash/tmp2 &&
+	test $(ls -1 trash/cache/snapshot-* | wc -l) = 1 &&
+	tail -c 10240 trash/tmp >trash/expected &&
+	tail -c 10240 trash/tmp2 >trash/actual &&
+	cmp trash/expected trash/actual
+'
+
+run_test 'answer HEAD requests from the snapshot cache' '
+	REQUEST_METHOD=HEAD CGIT_CONFIG="$PWD/trash/cgitrc.snapshots" \
+		QUERY_STRING="url=foo/snapshot/master.tar" \
+		"$PWD/../cgit" >trash/tmp &&
+	size=$(cat trash/cache/snapshot-* | wc -c | tr -d " ") &&
+	grep -a -e "^Content-Length: $size" trash/tmp &&
+	test $(wc -c <trash/tmp) -lt 10240
+'
+
+run_test 'do not generate snapshots for HEAD requests' '
+	REQUEST_METHOD=HEAD CGIT_CONFIG="$PWD/trash/cgitrc.snapshots" \
+		QUERY_STRING="url=foo/snapshot/master.tar.gz" \
+		"$PWD/../cgit" >trash/tmp &&
+	grep -a -e "^Content-Type: application/x-gzip" trash/tmp &&
+	test $(ls -1 trash/cache/snapshot-* | wc -l) = 1
+'
+
+run_test 'keep cached snapshots out of the page cache' '
+	cat trash/cgitrc >trash/cgitrc.pagecache &&
+	echo "cache-size=1021" >>trash/cgitrc.pagecache &&
+	echo "snapshot-cache-size=1" >>trash/cgitrc.pagecache &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.pagecache" \
+		QUERY_STRING="url=foo/snapshot/master.tar&t0107=$$" \
+		"$PWD/../cgit" >trash/tmp &&
+	test $(ls -1 trash/cache/snapshot-* | wc -l) = 1 &&
+	! grep -a -l -e "t0107=$$" trash/cache/*
+'
+
 tests_done
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Check pages rendered with repository indexes"
+
+subjects()
+{
+	rm -rf trash/cache/*
+	cgit_url "$1" | grep -o ">commit [0-9]*<"
+}
+
+run_test 'generate bar/log' 'subjects "bar/log?ofs=10" >trash/log'
+run_test 'generate bar/log/file-7' 'subjects "bar/log/file-7" >trash/path'
+run_test 'generate bar/atom' 'subjects "bar/atom" >trash/atom'
+
+run_test 'build indexes' '
+	CGIT_CONFIG="$PWD/trash/cgitrc" "$PWD/../cgit" --build-index --repo=bar &&
+	test -f trash/repos/bar/.git/info/cgit/log-index &&
+	test -f trash/repos/bar/.git/info/cgit/commit-graph &&
+	test -f trash/repos/bar/.git/info/cgit/path-bloom
+'
+
+run_test 'compare bar/log' 'subjects "bar/log?ofs=10" | cmp - trash/log'
+run_test 'compare bar/log/file-7' '
+	subjects "bar/log/file-7" | cmp - trash/path &&
+	test $(wc -l <trash/path) = 1
+'
+run_test 'compare bar/atom' 'subjects "bar/atom" | cmp - trash/atom'
+
+run_test 'remove indexes' 'rm -rf trash/repos/bar/.git/info/cgit'
+
+run_test 'build stats caches for each repo' '
+	echo "max-stats=year" >trash/cgitrc.stats &&
+	cat trash/cgitrc >>trash/cgitrc.stats &&
+	rm -f trash/cache/stats-* &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.stats" "$PWD/../cgit" \
+		--build-index=stats &&
+	test $(ls -1 trash/cache/stats-* | wc -l) = 4 &&
+	test $(grep -a -l -e "repos/foo/.git" trash/cache/stats-* | wc -l) = 1 &&
+	test $(grep -a -l -e "repos/bar/.git" trash/cache/stats-* | wc -l) = 1 &&
+	test $(grep -a -l -e "repos/foo+bar/.git" trash/cache/stats-* | wc -l) = 2
+'
+
+tests_done
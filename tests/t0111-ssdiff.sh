@@ -0,0 +1,85 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Check intraline highlighting in side-by-side diffs"
+
+# Line pairs which used to take quadratic time and stack space
+longline()
+{
+	awk -v n=$1 -v s="$2" 'BEGIN { for (i = 0; i < n; i++) printf "%s", s; print "" }'
+}
+
+mklongrepo()
+{
+	dir=$PWD
+	mkdir -p trash/repos/long && cd trash/repos/long && git init &&
+	longline 20000 a >similar && longline 20000 x >different &&
+	longline 10000 ab >shifted && seq 10000 >hunk && longline 100 xa >alternating &&
+	git add . && git commit -m "long lines" &&
+	{ longline 10000 a; printf b; longline 9999 a; } >similar &&
+	longline 20000 y >different && longline 10000 ba >shifted &&
+	longline 100 ya >alternating &&
+	seq 10000 | sed -e "s/\$/	x/" >hunk &&
+	git commit -a -m "change long lines"
+	res=$?
+	cd $dir
+	return $res
+}
+
+cat >>trash/cgitrc <<EOF2
+
+repo.url=long
+repo.path=$PWD/trash/repos/long/.git
+EOF2
+
+run_test 'create repo with long lines' '
+	test -f trash/repos/long/alternating ||
+	{ rm -rf trash/repos/long && mklongrepo >/dev/null; }
+'
+run_test 'generate long/diff with ss=1' '
+	cgit_url "long/diff&ss=1" >trash/tmp
+'
+run_test 'find changed character' '
+	grep -e "<span class=.add.>b</span>" trash/tmp
+'
+run_test 'find changed lines' '
+	test $(grep -o "class=.changed." trash/tmp | wc -l) -ge 6
+'
+run_test 'find 10k line hunk' '
+	grep -e "<td class=.lineno.>10000</td><td class=.changed.>10000<span class=.add.> *x</span>" trash/tmp
+'
+run_test 'find alternating changes' '
+	grep -e "<span class=.add.>y</span>a<span class=.add.>y</span>a" trash/tmp &&
+	! grep -e "<span class=.add.>yay" trash/tmp
+'
+run_test 'find only changed character without word highlighting' '
+	! grep -e "<span class=.add.>aa*baa*</span>" trash/tmp
+'
+
+# The configurations below change the page, so they bypass the page cache
+run_test 'generate long/diff with capped cost' '
+	echo "max-ssdiff-cost=1000" >trash/cgitrc.capped &&
+	cat trash/cgitrc >>trash/cgitrc.capped &&
+	echo "cache-size=0" >>trash/cgitrc.capped &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.capped" QUERY_STRING="url=long/diff&ss=1" \
+		"$PWD/../cgit" >trash/tmp
+'
+run_test 'find alternating changes highlighted as a whole' '
+	grep -e "<span class=.add.>yay\(ay\)*</span>a<" trash/tmp &&
+	! grep -e "<span class=.add.>y</span>a<span class=.add.>y</span>a" trash/tmp
+'
+
+run_test 'generate long/diff with word highlighting' '
+	echo "intraline-diff=word" >trash/cgitrc.word &&
+	cat trash/cgitrc >>trash/cgitrc.word &&
+	echo "cache-size=0" >>trash/cgitrc.word &&
+	CGIT_CONFIG="$PWD/trash/cgitrc.word" QUERY_STRING="url=long/diff&ss=1" \
+		"$PWD/../cgit" >trash/tmp
+'
+run_test 'find changed word' '
+	grep -e "<span class=.add.>aa*baa*</span>" trash/tmp &&
+	! grep -e "<span class=.add.>b</span>" trash/tmp
+'
+
+tests_done
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Verify range requests"
+
+cgit_range()
+{
+	HTTP_RANGE="$1" cgit_url "$2"
+}
+
+run_test 'full response advertises ranges' '
+	cgit_url "foo+bar/plain/a+b" >trash/tmp &&
+	grep -e "^Accept-Ranges: bytes" trash/tmp &&
+	! grep -e "^Status:" trash/tmp
+'
+
+run_test 'single range' '
+	cgit_range "bytes=1-3" "foo+bar/plain/a+b" >trash/tmp &&
+	grep -e "^Status: 206 Partial Content" trash/tmp &&
+	grep -e "^Content-Range: bytes 1-3/6" trash/tmp &&
+	grep -e "^Content-Length: 3" trash/tmp &&
+	test "$(tail -c 3 trash/tmp)" = "ell"
+'
+
+run_test 'suffix range' '
+	cgit_range "bytes=-2" "foo+bar/plain/a+b" >trash/tmp &&
+	grep -e "^Content-Range: bytes 4-5/6" trash/tmp
+'
+
+run_test 'multiple ranges' '
+	cgit_range "bytes=0-0,4-" "foo+bar/plain/a+b" >trash/tmp &&
+	grep -e "^Content-Type: multipart/byteranges; boundary=" trash/tmp &&
+	grep -e "^Content-Range: bytes 0-0/6" trash/tmp &&
+	grep -e "^Content-Range: bytes 4-5/6" trash/tmp
+'
+
+run_test 'unsatisfiable range' '
+	cgit_range "bytes=10-" "foo+bar/plain/a+b" >trash/tmp &&
+	grep -e "^Status: 416" trash/tmp &&
+	grep -e "^Content-Range: bytes \*/6" trash/tmp
+'
+
+run_test 'stale If-Range sends everything' '
+	HTTP_IF_RANGE="\"0000\"" cgit_range "bytes=1-3" "foo+bar/plain/a+b" >trash/tmp &&
+	! grep -e "^Status:" trash/tmp &&
+	grep -e "^hello" trash/tmp
+'
+
+run_test 'resume a dumb clone object' '
+	obj=$(cd trash/repos/foo && git rev-parse HEAD) &&
+	path=objects/$(echo $obj | cut -c1-2)/$(echo $obj | cut -c3-) &&
+	size=$(wc -c <trash/repos/foo/.git/$path | tr -d " ") &&
+	cgit_range "bytes=2-" "foo/$path" >trash/tmp &&
+	grep -e "^Content-Range: bytes 2-$(($size - 1))/$size" trash/tmp &&
+	tail -c +3 trash/repos/foo/.git/$path >trash/expected &&
+	tail -c $(($size - 2)) trash/tmp >trash/actual &&
+	cmp trash/expected trash/actual
+'
+
+tests_done
@@ -0,0 +1,113 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Verify conditional requests"
+
+etag()
+{
+	cgit_url "$1" | sed -n -e 's/^ETag: //p'
+}
+
+run_test 'commit page has an etag' '
+	test -n "$(etag "foo/commit")"
+'
+
+run_test 'matching If-None-Match gives 304' '
+	tag=$(etag "foo/commit") &&
+	HTTP_IF_NONE_MATCH="$tag" cgit_url "foo/commit" >trash/tmp &&
+	grep -e "^Status: 304 Not Modified" trash/tmp &&
+	! grep -e "<html" trash/tmp
+'
+
+run_test 'stale If-None-Match gives the page' '
+	HTTP_IF_NONE_MATCH="\"0000\"" cgit_url "foo/commit" >trash/tmp &&
+	! grep -e "^Status: 304" trash/tmp &&
+	grep -e "commit 5" trash/tmp
+'
+
+
+run_test 'old If-Modified-Since gives the page' '
+	HTTP_IF_MODIFIED_SINCE="Thu, 01 Jan 1970 00:00:00 GMT" \
+		cgit_url "foo/patch" >trash/tmp &&
+	! grep -e "^Status: 304" trash/tmp
+'
+
+run_test 'plain file revalidation' '
+	tag=$(etag "foo/plain/file-1") &&
+	HTTP_IF_NONE_MATCH="$tag" cgit_url "foo/plain/file-1" >trash/tmp &&
+	grep -e "^Status: 304 Not Modified" trash/tmp
+'
+
+# A repo which is changed by the tests below, with commits from 2005
+mkcondrepo()
+{
+	dir=$PWD
+	rm -rf trash/repos/cond &&
+	mkdir -p trash/repos/cond && cd trash/repos/cond && git init &&
+	echo 1 >file && git add file &&
+	GIT_AUTHOR_DATE="1111111111 +0000" GIT_COMMITTER_DATE="1111111111 +0000" \
+		git commit -m "commit 1"
+	res=$?
+	cd $dir
+	return $res
+}
+
+add_commit()
+{
+	(
+		cd trash/repos/cond &&
+		echo $1 >file &&
+		GIT_AUTHOR_DATE="$2 +0000" GIT_COMMITTER_DATE="$2 +0000" \
+			git commit -a -m "commit $1"
+	) >/dev/null 2>&1
+}
+
+# The page cache would serve the same page for the same URL
+cp trash/cgitrc trash/cgitrc.cond
+cat >>trash/cgitrc.cond <<EOF
+cache-size=0
+
+repo.url=cond
+repo.path=$PWD/trash/repos/cond/.git
+EOF
+
+cond_url()
+{
+	CGIT_CONFIG="$PWD/trash/cgitrc.cond" QUERY_STRING="url=$1" "$PWD/../cgit"
+}
+
+cond_etag()
+{
+	cond_url "$1" | sed -n -e 's/^ETag: //p'
+}
+
+run_test 'create repo' 'mkcondrepo >/dev/null 2>&1'
+
+run_test 'etag depends on the commit' '
+	tag=$(cond_etag "cond/commit") &&
+	test -n "$tag" &&
+	add_commit 2 1111112222 &&
+	test "$(cond_etag "cond/commit")" != "$tag"
+'
+
+run_test 'etag depends on the refs' '
+	tag=$(cond_etag "cond/commit") &&
+	(cd trash/repos/cond && git branch side HEAD^) &&
+	test "$(cond_etag "cond/commit")" != "$tag"
+'
+
+run_test 'If-Modified-Since the commit date gives the page after ref changes' '
+	HTTP_IF_MODIFIED_SINCE="Fri, 18 Mar 2005 02:17:02 GMT" \
+		cond_url "cond/commit" >trash/tmp &&
+	! grep -e "^Status: 304" trash/tmp &&
+	grep -e "commit 2" trash/tmp
+'
+
+run_test 'current If-Modified-Since gives 304' '
+	date=$(cond_url "cond/commit" | sed -n -e "s/^Last-Modified: //p") &&
+	HTTP_IF_MODIFIED_SINCE="$date" cond_url "cond/commit" >trash/tmp &&
+	grep -e "^Status: 304 Not Modified" trash/tmp
+'
+
+tests_done
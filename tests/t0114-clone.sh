@@ -0,0 +1,136 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Verify dumb clone info"
+
+run_test 'list refs' '
+	cgit_url "foo/info/refs" >trash/tmp &&
+	head=$(cd trash/repos/foo && git rev-parse master) &&
+	grep -e "^$head	refs/heads/master" trash/tmp
+'
+
+run_test 'list refs from the refs cache' '
+	ls trash/cache/refs-info-* &&
+	cgit_url "foo/info/refs" >trash/tmp2 &&
+	tail -n 1 trash/tmp >trash/expected &&
+	tail -n 1 trash/tmp2 >trash/actual &&
+	cmp trash/expected trash/actual
+'
+
+run_test 'list annotated tags with their peeled value' '
+	(cd trash/repos/foo && git tag -a -m "tag" refs-cache-test master) &&
+	tag=$(cd trash/repos/foo && git rev-parse refs-cache-test) &&
+	head=$(cd trash/repos/foo && git rev-parse master) &&
+	cgit_query "r=foo&p=info&path=refs" >trash/tmp &&
+	(cd trash/repos/foo && git tag -d refs-cache-test) &&
+	grep -e "^$tag	refs/tags/refs-cache-test$" trash/tmp &&
+	grep -e "^$head	refs/tags/refs-cache-test^{}$" trash/tmp
+'
+
+# A repo with an annotated and a lightweight tag in packed-refs, and a
+# second branch to point HEAD at
+mktagsrepo()
+{
+	dir=$PWD
+	rm -rf trash/repos/tags &&
+	mkdir -p trash/repos/tags && cd trash/repos/tags && git init &&
+	echo 1 >file && git add file && git commit -m "commit 1" &&
+	git branch side &&
+	echo 2 >file && git commit -a -m "commit 2" &&
+	git tag -a -m "tag" annotated HEAD^ &&
+	git tag light HEAD &&
+	git pack-refs --all
+	res=$?
+	cd $dir
+	return $res
+}
+
+cat >trash/cgitrc.tags <<EOF
+cache-size=0
+enable-smart-http=1
+
+repo.url=tags
+repo.path=$PWD/trash/repos/tags/.git
+EOF
+
+tags_url()
+{
+	CGIT_CONFIG="$PWD/trash/cgitrc.tags" QUERY_STRING="url=$1" "$PWD/../cgit"
+}
+
+run_test 'create repo with packed tags' '
+	mktagsrepo >/dev/null 2>&1
+'
+
+run_test 'list packed tags with their peeled value' '
+	tag=$(cd trash/repos/tags && git rev-parse annotated) &&
+	commit=$(cd trash/repos/tags && git rev-parse HEAD^) &&
+	grep -e "^\^$commit" trash/repos/tags/.git/packed-refs &&
+	tags_url "tags/info/refs" >trash/tmp &&
+	grep -e "^$tag	refs/tags/annotated$" trash/tmp &&
+	grep -e "^$commit	refs/tags/annotated^{}$" trash/tmp &&
+	! grep -e "refs/tags/light" trash/tmp
+'
+
+run_test 'advertise the new HEAD after it is repointed' '
+	tags_url "tags/info/refs&service=git-upload-pack" >trash/tmp &&
+	head=$(cd trash/repos/tags && git rev-parse master) &&
+	grep -e "$head HEAD" trash/tmp &&
+	(cd trash/repos/tags && git symbolic-ref HEAD refs/heads/side) &&
+	tags_url "tags/info/refs&service=git-upload-pack" >trash/tmp &&
+	head=$(cd trash/repos/tags && git rev-parse side) &&
+	grep -e "$head HEAD" trash/tmp
+'
+
+echo "enable-smart-http=1" >trash/cgitrc.smart
+cat trash/cgitrc >>trash/cgitrc.smart
+
+smart_url()
+{
+	CGIT_CONFIG="$PWD/trash/cgitrc.smart" QUERY_STRING="url=$1" "$PWD/../cgit"
+}
+
+run_test 'advertise refs to smart clients' '
+	smart_url "foo/info/refs&service=git-upload-pack" >trash/tmp &&
+	grep -e "^Content-Type: application/x-git-upload-pack-advertisement" trash/tmp &&
+	grep -e "^001e# service=git-upload-pack" trash/tmp &&
+	grep -e "refs/heads/master" trash/tmp
+'
+
+run_test 'refuse to advertise git-receive-pack' '
+	smart_url "foo/info/refs&service=git-receive-pack" >trash/tmp &&
+	grep -e "^Status: 403" trash/tmp
+'
+
+run_test 'refuse GET requests to git-upload-pack' '
+	REQUEST_METHOD=GET smart_url "foo/git-upload-pack" >trash/tmp &&
+	grep -e "^Status: 405" trash/tmp
+'
+
+run_test 'refuse other content types' '
+	REQUEST_METHOD=POST CONTENT_TYPE=text/plain \
+		smart_url "foo/git-upload-pack" </dev/null >trash/tmp &&
+	grep -e "^Status: 415" trash/tmp
+'
+
+run_test 'fetch through git-upload-pack' '
+	head=$(cd trash/repos/foo && git rev-parse master) &&
+	printf "0032want %s\n00000009done\n" $head >trash/request &&
+	REQUEST_METHOD=POST CONTENT_TYPE=application/x-git-upload-pack-request \
+		smart_url "foo/git-upload-pack" <trash/request >trash/tmp &&
+	grep -e "^Content-Type: application/x-git-upload-pack-result" trash/tmp &&
+	grep -e "0008NAK" trash/tmp &&
+	grep -e "PACK" trash/tmp
+'
+
+run_test 'fetch through git-upload-pack with a gzipped request' '
+	gzip -c trash/request >trash/request.gz &&
+	REQUEST_METHOD=POST CONTENT_TYPE=application/x-git-upload-pack-request \
+		HTTP_CONTENT_ENCODING=gzip \
+		smart_url "foo/git-upload-pack" <trash/request.gz >trash/tmp &&
+	grep -e "0008NAK" trash/tmp &&
+	grep -e "PACK" trash/tmp
+'
+
+tests_done
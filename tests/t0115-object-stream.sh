@@ -0,0 +1,137 @@
+#!/bin/sh
+
+. ./setup.sh
+
+prepare_tests "Stream packed and loose objects"
+
+# Two versions of a file larger than the stream buffer, packed so that one
+# is stored whole and the other as a delta against it
+mkpackedrepo()
+{
+	dir=$PWD
+	mkdir -p trash/repos/packed && cd trash/repos/packed && git init &&
+	seq 1 30000 >big && git add big && git commit -m "big" &&
+	echo 30001 >>big && git commit -a -m "bigger" &&
+	git gc --quiet
+	res=$?
+	cd $dir
+	return $res
+}
+
+# The same file in a repo which is never packed
+mklooserepo()
+{
+	dir=$PWD
+	mkdir -p trash/repos/loose && cd trash/repos/loose && git init &&
+	seq 1 30000 >big && git add big && git commit -m "big"
+	res=$?
+	cd $dir
+	return $res
+}
+
+cat >>trash/cgitrc <<EOF
+
+repo.url=packed
+repo.path=$PWD/trash/repos/packed/.git
+
+repo.url=loose
+repo.path=$PWD/trash/repos/loose/.git
+EOF
+
+# Print "delta" or "whole" for the packed blob `big` in the revision $1
+packed_as()
+{
+	(
+		cd trash/repos/packed &&
+		blob=$(git rev-parse $1:big) &&
+		git verify-pack -v .git/objects/pack/*.idx |
+		awk -v b=$blob '$1 == b { print (NF > 5 ? "delta" : "whole") }'
+	)
+}
+
+# Compare the plain content of `big` in the revision $1 of the repo $2
+# (default: packed) to git's
+check_plain()
+{
+	repo=${2:-packed} &&
+	id=$(cd trash/repos/$repo && git rev-parse $1) &&
+	(cd trash/repos/$repo && git cat-file blob $id:big) >trash/expected &&
+	size=$(wc -c <trash/expected | tr -d " ") &&
+	cgit_url "$repo/plain/big&id=$id" >trash/tmp &&
+	grep -e "^Content-Length: $size" trash/tmp &&
+	tail -c $size trash/tmp >trash/actual &&
+	cmp trash/expected trash/actual
+}
+
+# Compare a range from the middle of `big` in the revision $1 of the repo
+# $2 (default: packed) to git's
+check_range()
+{
+	repo=${2:-packed} &&
+	id=$(cd trash/repos/$repo && git rev-parse $1) &&
+	(cd trash/repos/$repo && git cat-file blob $id:big) |
+		tail -c +100001 | head -c 1000 >trash/expected &&
+	HTTP_RANGE="bytes=100000-100999" cgit_url "$repo/plain/big&id=$id" >trash/tmp &&
+	grep -e "^Status: 206" trash/tmp &&
+	tail -c 1000 trash/tmp >trash/actual &&
+	cmp trash/expected trash/actual
+}
+
+run_test 'create packed repo' '
+	test -d trash/repos/packed || mkpackedrepo >/dev/null 2>&1
+'
+
+run_test 'one version is whole and one is a delta' '
+	test "$(packed_as HEAD) $(packed_as HEAD^)" = "whole delta" ||
+	test "$(packed_as HEAD) $(packed_as HEAD^)" = "delta whole"
+'
+
+run_test 'read whole packed object' '
+	if test "$(packed_as HEAD)" = whole
+	then
+		check_plain HEAD
+	else
+		check_plain HEAD^
+	fi
+'
+
+run_test 'read deltified packed object' '
+	if test "$(packed_as HEAD)" = delta
+	then
+		check_plain HEAD
+	else
+		check_plain HEAD^
+	fi
+'
+
+run_test 'read range of whole packed object' '
+	if test "$(packed_as HEAD)" = whole
+	then
+		check_range HEAD
+	else
+		check_range HEAD^
+	fi
+'
+
+run_test 'read range of deltified packed object' '
+	if test "$(packed_as HEAD)" = delta
+	then
+		check_range HEAD
+	else
+		check_range HEAD^
+	fi
+'
+
+run_test 'create loose repo' '
+	test -d trash/repos/loose || mklooserepo >/dev/null 2>&1
+'
+
+run_test 'the object is loose' '
+	blob=$(cd trash/repos/loose && git rev-parse HEAD:big) &&
+	test -f trash/repos/loose/.git/objects/$(echo $blob | cut -c1-2)/$(echo $blob | cut -c3-)
+'
+
+run_test 'read loose object' 'check_plain HEAD loose'
+run_test 'read range of loose object' 'check_range HEAD loose'
+
+tests_done
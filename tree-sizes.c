@@ -0,0 +1,239 @@
+/* tree-sizes.c: batched lookup of the object sizes shown in tree listings
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The entries of a tree are looked up sorted by pack and offset, so the
+ * packs are read front to back instead of at random. The size of a packed
+ * object is read from its entry in the pack, which was already found for
+ * sorting; only loose objects are looked up once more by their sha1.
+ *
+ * If the page cache is enabled, the result is saved in the cache root.
+ * Like the pages, the sizes use at most cache-size files, the slot being
+ * chosen by the tree sha1; a tree sharing the slot simply replaces them.
+ * Trees never change, so a saved file stays valid as long as it holds the
+ * sha1 of the tree.
+ *
+ * All integers are stored in network byte order:
+ *
+ *   header       3 x uint32: magic, version, number of entries
+ *   tree         sha1 of the tree
+ *   entries      3 x uint32 per tree entry, in tree order: object type,
+ *                upper and lower half of the object size
+ */
+
+#include "cgit.h"
+#include "tree-sizes.h"
+
+#define SIZES_MAGIC    0x43545a53 /* "CTZS" */
+#define SIZES_VERSION  1
+
+struct sizes_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nr;
+	unsigned char tree[20];
+};
+
+struct size_lookup {
+	int idx;
+	int pack;
+	off_t ofs;
+};
+
+static const char *sizes_path(const unsigned char *tree_sha1)
+{
+	uint32_t hash;
+
+	memcpy(&hash, tree_sha1, sizeof(hash));
+	return fmt("%s/sizes-%x", ctx.cfg.cache_root,
+		   ntohl(hash) % ctx.cfg.cache_size);
+}
+
+/* Fill `sizes` from the saved file, return 0 on success and -1 if there is
+ * no valid file for the tree.
+ */
+static int read_sizes(const unsigned char *tree_sha1, struct tree_size *sizes,
+		      int nr)
+{
+	const struct sizes_header *hdr;
+	const uint32_t *entry;
+	char *buf;
+	size_t size;
+	int i;
+
+	if (readfile(sizes_path(tree_sha1), &buf, &size))
+		return -1;
+	hdr = (const struct sizes_header *)buf;
+	if (size != sizeof(*hdr) + (size_t)nr * 12 ||
+	    ntohl(hdr->magic) != SIZES_MAGIC ||
+	    ntohl(hdr->version) != SIZES_VERSION ||
+	    ntohl(hdr->nr) != nr || hashcmp(hdr->tree, tree_sha1)) {
+		free(buf);
+		return -1;
+	}
+	entry = (const uint32_t *)(hdr + 1);
+	for (i = 0; i < nr; i++, entry += 3) {
+		sizes[i].type = ntohl(entry[0]);
+		sizes[i].size = ((uint64_t)ntohl(entry[1]) << 32) |
+			ntohl(entry[2]);
+	}
+	free(buf);
+	return 0;
+}
+
+/* Save the sizes, return 0 on success and errno otherwise */
+static int write_sizes(const unsigned char *tree_sha1,
+		       const struct tree_size *sizes, int nr)
+{
+	struct sizes_header hdr;
+	struct strbuf sb = STRBUF_INIT;
+	uint32_t entry[3];
+	char *path, *lock;
+	int fd, i, err = 0;
+
+	hdr.magic = htonl(SIZES_MAGIC);
+	hdr.version = htonl(SIZES_VERSION);
+	hdr.nr = htonl(nr);
+	hashcpy(hdr.tree, tree_sha1);
+	strbuf_add(&sb, &hdr, sizeof(hdr));
+	for (i = 0; i < nr; i++) {
+		entry[0] = htonl(sizes[i].type);
+		entry[1] = htonl((uint64_t)sizes[i].size >> 32);
+		entry[2] = htonl(sizes[i].size & 0xffffffff);
+		strbuf_add(&sb, entry, sizeof(entry));
+	}
+
+	path = xstrdup(sizes_path(tree_sha1));
+	lock = xstrdup(fmt("%s.lock", path));
+	fd = cgit_open_lock(lock);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+	if (write_in_full(fd, sb.buf, sb.len) < 0)
+		err = errno;
+	if (!err && rename(lock, path))
+		err = errno;
+	if (err)
+		unlink(lock);
+	close(fd);
+out:
+	free(lock);
+	free(path);
+	strbuf_release(&sb);
+	return err;
+}
+
+static int cmp_lookups(const void *a, const void *b)
+{
+	const struct size_lookup *l1 = a, *l2 = b;
+
+	if (l1->pack != l2->pack)
+		return l1->pack < l2->pack ? -1 : 1;
+	if (l1->ofs != l2->ofs)
+		return l1->ofs < l2->ofs ? -1 : 1;
+	return 0;
+}
+
+/* Read the type and size of the object at `ofs` in `p`. The size of a
+ * deltified object is the size of the result, which is recorded in the
+ * delta; its type is left as the caller expected it.
+ */
+static int packed_size(struct packed_git *p, off_t ofs, struct tree_size *s)
+{
+	struct pack_window *w_curs = NULL;
+	enum object_type type;
+	unsigned long size, used;
+	unsigned char *base;
+	unsigned int left;
+
+	base = use_pack(p, &w_curs, ofs, &left);
+	used = unpack_object_header_buffer(base, left, &type, &size);
+	if (!used) {
+		unuse_pack(&w_curs);
+		return -1;
+	}
+	ofs += used;
+	switch (type) {
+	case OBJ_REF_DELTA:
+		ofs += 20;
+		break;
+	case OBJ_OFS_DELTA:
+		/* Skip the offset of the base */
+		do {
+			base = use_pack(p, &w_curs, ofs++, &left);
+		} while (*base & 128);
+		break;
+	default:
+		s->type = type;
+		s->size = size;
+		unuse_pack(&w_curs);
+		return 0;
+	}
+	s->size = get_size_from_delta(p, &w_curs, ofs);
+	unuse_pack(&w_curs);
+	return 0;
+}
+
+/* Look up the sizes sorted by pack and offset, with loose objects last,
+ * return the number of objects which could not be found.
+ */
+static int lookup_sizes(struct tree_size *sizes, int nr)
+{
+	struct size_lookup *lookups;
+	struct packed_git *p, **packs = NULL;
+	int i, n = 0, pack, nr_packs = 0, bad = 0;
+
+	lookups = xmalloc(nr * sizeof(*lookups));
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next)
+		nr_packs++;
+	packs = xmalloc((nr_packs + 1) * sizeof(*packs));
+	for (p = packed_git, pack = 0; p; p = p->next, pack++)
+		packs[pack] = p;
+	for (i = 0; i < nr; i++) {
+		sizes[i].size = 0;
+		if (!sizes[i].sha1)
+			continue;
+		lookups[n].idx = i;
+		lookups[n].ofs = 0;
+		for (pack = 0; pack < nr_packs; pack++) {
+			lookups[n].ofs = find_pack_entry_one(sizes[i].sha1,
+							     packs[pack]);
+			if (lookups[n].ofs)
+				break;
+		}
+		lookups[n++].pack = pack;
+	}
+	qsort(lookups, n, sizeof(*lookups), cmp_lookups);
+	for (i = 0; i < n; i++) {
+		struct tree_size *s = &sizes[lookups[i].idx];
+
+		if (lookups[i].pack < nr_packs &&
+		    !packed_size(packs[lookups[i].pack], lookups[i].ofs, s))
+			continue;
+		s->type = sha1_object_info(s->sha1, &s->size);
+		if (s->type == OBJ_BAD)
+			bad++;
+	}
+	free(packs);
+	free(lookups);
+	return bad;
+}
+
+void cgit_tree_sizes(const unsigned char *tree_sha1, struct tree_size *sizes,
+		     int nr)
+{
+	if (!nr)
+		return;
+	if (ctx.cfg.cache_size <= 0) {
+		lookup_sizes(sizes, nr);
+		return;
+	}
+	if (!read_sizes(tree_sha1, sizes, nr))
+		return;
+	if (!lookup_sizes(sizes, nr) && !access(ctx.cfg.cache_root, W_OK))
+		write_sizes(tree_sha1, sizes, nr);
+}
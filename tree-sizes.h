@@ -0,0 +1,24 @@
+#ifndef TREE_SIZES_H
+#define TREE_SIZES_H
+
+#include "cgit.h"
+
+/* The size of one entry of a tree listing. Entries without an object to
+ * look up (submodules) have a NULL sha1. The caller sets `type` to the type
+ * expected from the mode of the entry; it is replaced by the actual type,
+ * or OBJ_BAD if the object is missing, unless the object is deltified.
+ */
+struct tree_size {
+	const unsigned char *sha1;
+	unsigned long size;
+	enum object_type type;
+};
+
+/* Look up the sizes of the `nr` entries of the tree `tree_sha1`, in pack
+ * order, or take them from the sizes saved for that tree in the cache root
+ * if the page cache is enabled.
+ */
+extern void cgit_tree_sizes(const unsigned char *tree_sha1,
+			    struct tree_size *sizes, int nr);
+
+#endif /* TREE_SIZES_H */
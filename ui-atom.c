@@ -9,6 +9,7 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "commit-graph.h"
 
 void add_entry(struct commit *commit, char *host)
 {
@@ -83,7 +84,8 @@ void cgit_print_atom(char *tip, char *path, int max_count)
 	const char *argv[] = {NULL, tip, NULL, NULL, NULL};
 	struct commit *commit;
 	struct rev_info rev;
-	int argc = 2;
+	struct graph_walk walk;
+	int argc = 2, count = 0, use_graph = 1;
 
 	if (ctx.qry.show_all)
 		argv[1] = "--all";
@@ -95,14 +97,17 @@ void cgit_print_atom(char *tip, char *path, int max_count)
 		argv[argc++] = path;
 	}
 
-	init_revisions(&rev, NULL);
-	rev.abbrev = DEFAULT_ABBREV;
-	rev.commit_format = CMIT_FMT_DEFAULT;
-	rev.verbose_header = 1;
-	rev.show_root_diff = 0;
-	rev.max_count = max_count;
-	setup_revisions(argc, argv, &rev, NULL);
-	prepare_revision_walk(&rev);
+	if (ctx.qry.show_all || cgit_graph_walk_setup(&walk, argv[1], path)) {
+		use_graph = 0;
+		init_revisions(&rev, NULL);
+		rev.abbrev = DEFAULT_ABBREV;
+		rev.commit_format = CMIT_FMT_DEFAULT;
+		rev.verbose_header = 1;
+		rev.show_root_diff = 0;
+		rev.max_count = max_count;
+		setup_revisions(argc, argv, &rev, NULL);
+		prepare_revision_walk(&rev);
+	}
 
 	host = cgit_hosturl();
 	ctx.page.mimetype = "text/xml";
@@ -122,12 +127,22 @@ void cgit_print_atom(char *tip, char *path, int max_count)
 		html_attr(cgit_repourl(ctx.repo->url));
 		html("'/>\n");
 	}
-	while ((commit = get_revision(&rev)) != NULL) {
+	while (1) {
+		if (!use_graph)
+			commit = get_revision(&rev);
+		else if (max_count < 0 || count++ < max_count)
+			commit = cgit_graph_walk_next(&walk);
+		else
+			commit = NULL;
+		if (!commit)
+			break;
 		add_entry(commit, host);
 		free(commit->buffer);
 		commit->buffer = NULL;
 		free_commit_list(commit->parents);
 		commit->parents = NULL;
 	}
+	if (use_graph)
+		cgit_graph_walk_release(&walk);
 	html("</feed>\n");
 }
@@ -10,60 +10,42 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
-
-static char *match_path;
-static unsigned char *matched_sha1;
-static int found_path;
-
-static int walk_tree(const unsigned char *sha1, const char *base,int baselen,
-	const char *pathname, unsigned mode, int stage, void *cbdata) {
-	if(strncmp(base,match_path,baselen)
-		|| strcmp(match_path+baselen,pathname) )
-		return READ_TREE_RECURSIVE;
-	memmove(matched_sha1,sha1,20);
-	found_path = 1;
-	return 0;
-}
+#include "object-stream.h"
 
 int cgit_print_file(char *path, const char *head)
 {
-	unsigned char sha1[20];
+	unsigned char sha1[20], sha1_rev[20];
 	enum object_type type;
-	char *buf;
+	struct object_stream st;
 	unsigned long size;
-	struct commit *commit;
-	const char *paths[] = {path, NULL};
+	int err;
 	if (get_sha1(head, sha1))
 		return -1;
 	type = sha1_object_info(sha1, &size);
 	if(type == OBJ_COMMIT && path) {
-		commit = lookup_commit_reference(sha1);
-		match_path = path;
-		matched_sha1 = sha1;
-		found_path = 0;
-		read_tree_recursive(commit->tree, "", 0, 0, paths, walk_tree, NULL);
-		if (!found_path)
+		hashcpy(sha1_rev, sha1);
+		if (cgit_find_object_by_path(sha1_rev, path, 0, sha1, NULL,
+					     NULL))
 			return -1;
 		type = sha1_object_info(sha1, &size);
 	}
 	if (type == OBJ_BAD)
 		return -1;
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf)
+	if (cgit_open_object_stream(sha1, &st))
 		return -1;
-	buf[size] = '\0';
-	write(htmlfd, buf, size);
-	return 0;
+	err = cgit_copy_object_stream(&st, htmlfd, st.size);
+	cgit_close_object_stream(&st);
+	return err;
 }
 
 void cgit_print_blob(const char *hex, char *path, const char *head)
 {
-	unsigned char sha1[20];
+	unsigned char sha1[20], sha1_rev[20];
 	enum object_type type;
-	char *buf;
-	unsigned long size;
-	struct commit *commit;
-	const char *paths[] = {path, NULL};
+	struct object_stream st;
+	const char *buf;
+	char *errmsg = NULL;
+	unsigned long size, n;
 
 	if (hex) {
 		if (get_sha1_hex(hex, sha1)){
@@ -80,10 +62,13 @@ void cgit_print_blob(const char *hex, char *path, const char *head)
 	type = sha1_object_info(sha1, &size);
 
 	if((!hex) && type == OBJ_COMMIT && path) {
-		commit = lookup_commit_reference(sha1);
-		match_path = path;
-		matched_sha1 = sha1;
-		read_tree_recursive(commit->tree, "", 0, 0, paths, walk_tree, NULL);
+		hashcpy(sha1_rev, sha1);
+		if (cgit_find_object_by_path(sha1_rev, path, 0, sha1, NULL,
+					     &errmsg)) {
+			cgit_print_error(errmsg);
+			free(errmsg);
+			return;
+		}
 		type = sha1_object_info(sha1,&size);
 	}
 
@@ -92,21 +77,29 @@ void cgit_print_blob(const char *hex, char *path, const char *head)
 		return;
 	}
 
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf) {
+	ctx.page.etag = xstrdup(sha1_to_hex(sha1));
+	if (cgit_print_not_modified(&ctx))
+		return;
+	if (cgit_open_object_stream(sha1, &st)) {
 		cgit_print_error(fmt("Error reading object %s", hex));
 		return;
 	}
+	buf = cgit_peek_object_stream(&st, &n);
+	if (!buf) {
+		cgit_print_error(fmt("Error reading object %s", hex));
+		goto out;
+	}
 
-	buf[size] = '\0';
 	ctx.page.mimetype = ctx.qry.mimetype;
 	if (!ctx.page.mimetype) {
-		if (buffer_is_binary(buf, size))
+		if (buffer_is_binary(buf, n))
 			ctx.page.mimetype = "application/octet-stream";
 		else
 			ctx.page.mimetype = "text/plain";
 	}
 	ctx.page.filename = path;
-	cgit_print_http_headers(&ctx);
-	write(htmlfd, buf, size);
+	ctx.page.size = st.size;
+	cgit_print_http_ranged(&ctx, cgit_object_stream_range, &st);
+out:
+	cgit_close_object_stream(&st);
 }
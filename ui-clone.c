@@ -10,26 +10,125 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "refs-cache.h"
+#include <run-command.h>
 
-static int print_ref_info(const char *refname, const unsigned char *sha1,
-                          int flags, void *cb_data)
+/* A tag of packed-refs and its peeled value, null if it was not peeled */
+struct packed_tag {
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+struct ref_info {
+	struct strbuf *buf;
+	struct string_list tags;
+	int peeled;
+};
+
+/* Read the tags of packed-refs once, peel_ref() would search the packed
+ * refs for every single tag. The peeled values are only usable if the
+ * file says pack-refs recorded them.
+ */
+static char *read_packed_tags(struct ref_info *info)
+{
+	struct packed_tag *tag = NULL;
+	char *buf, *line, *eol;
+	size_t size;
+
+	if (readfile(git_path("packed-refs"), &buf, &size))
+		return NULL;
+	for (line = buf; line < buf + size; line = eol + 1) {
+		eol = memchr(line, '\n', buf + size - line);
+		if (!eol)
+			break;
+		*eol = '\0';
+		if (!prefixcmp(line, "# pack-refs with:")) {
+			info->peeled = strstr(line, " peeled") != NULL;
+			continue;
+		}
+		if (line[0] == '^') {
+			if (tag && get_sha1_hex(line + 1, tag->peeled))
+				hashclr(tag->peeled);
+			tag = NULL;
+			continue;
+		}
+		tag = NULL;
+		if (eol - line < 42 || line[40] != ' ' ||
+		    prefixcmp(line + 41, "refs/tags/"))
+			continue;
+		tag = xcalloc(1, sizeof(*tag));
+		if (get_sha1_hex(line, tag->sha1)) {
+			free(tag);
+			tag = NULL;
+			continue;
+		}
+		string_list_insert(&info->tags, line + 41)->util = tag;
+	}
+	return buf;
+}
+
+/* Store the object the tag `sha1` points to in `peeled`, return 0 if
+ * `refname` is an annotated tag.
+ */
+static int peel_tag(struct ref_info *info, const char *refname,
+		    const unsigned char *sha1, unsigned char *peeled)
 {
+	struct string_list_item *item;
+	struct packed_tag *tag;
 	struct object *obj;
 
-	if (!(obj = parse_object(sha1)))
-		return 0;
+	item = string_list_lookup(&info->tags, refname);
+	if (info->peeled && item) {
+		tag = item->util;
+		if (!hashcmp(tag->sha1, sha1)) {
+			if (is_null_sha1(tag->peeled))
+				return -1;
+			hashcpy(peeled, tag->peeled);
+			return 0;
+		}
+	}
+	obj = parse_object(sha1);
+	if (!obj || obj->type != OBJ_TAG)
+		return -1;
+	obj = deref_tag(obj, refname, 0);
+	if (!obj)
+		return -1;
+	hashcpy(peeled, obj->sha1);
+	return 0;
+}
+
+static int print_ref_info(const char *refname, const unsigned char *sha1,
+                          int flags, void *cb_data)
+{
+	struct ref_info *info = cb_data;
+	unsigned char peeled[20];
 
 	if (!strcmp(refname, "HEAD") || !prefixcmp(refname, "refs/heads/"))
-		htmlf("%s\t%s\n", sha1_to_hex(sha1), refname);
-	else if (!prefixcmp(refname, "refs/tags") && obj->type == OBJ_TAG) {
-		if (!(obj = deref_tag(obj, refname, 0)))
+		strbuf_addf(info->buf, "%s\t%s\n", sha1_to_hex(sha1), refname);
+	else if (!prefixcmp(refname, "refs/tags")) {
+		if (peel_tag(info, refname, sha1, peeled))
 			return 0;
-		htmlf("%s\t%s\n", sha1_to_hex(sha1), refname);
-		htmlf("%s\t%s^{}\n", sha1_to_hex(obj->sha1), refname);
+		strbuf_addf(info->buf, "%s\t%s\n", sha1_to_hex(sha1), refname);
+		strbuf_addf(info->buf, "%s\t%s^{}\n", sha1_to_hex(peeled),
+			    refname);
 	}
 	return 0;
 }
 
+static int fill_ref_info(struct strbuf *buf)
+{
+	struct ref_info info;
+	char *packed;
+
+	memset(&info, 0, sizeof(info));
+	info.buf = buf;
+	packed = read_packed_tags(&info);
+	for_each_ref(print_ref_info, &info);
+	string_list_clear(&info.tags, 1);
+	free(packed);
+	return 0;
+}
+
 static void print_pack_info(struct cgit_context *ctx)
 {
 	struct packed_git *pack;
@@ -45,11 +144,21 @@ static void print_pack_info(struct cgit_context *ctx)
 			htmlf("P %s\n", pack->pack_name + ofs);
 }
 
+static int send_file_range(void *data, int fd, unsigned long ofs,
+			   unsigned long len)
+{
+	return cgit_sendfile(fd, *(int *)data, ofs, len);
+}
+
 static void send_file(struct cgit_context *ctx, char *path)
 {
 	struct stat st;
+	int fd;
 
-	if (stat(path, &st)) {
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
 		switch (errno) {
 		case ENOENT:
 			html_status(404, "Not found", 0);
@@ -66,19 +175,149 @@ static void send_file(struct cgit_context *ctx, char *path)
 	ctx->page.filename = path;
 	if (prefixcmp(ctx->repo->path, path))
 		ctx->page.filename += strlen(ctx->repo->path) + 1;
+	ctx->page.size = st.st_size;
+	cgit_print_http_ranged(ctx, send_file_range, &fd);
+	close(fd);
+}
+
+/* Inflate the gzip compressed request body on stdin into `fd`, return 0
+ * on success.
+ */
+static int inflate_request(int fd)
+{
+	unsigned char in[8192], out[8192];
+	z_stream z;
+	ssize_t n;
+	int status = Z_OK;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 16) != Z_OK)
+		return -1;
+	while (status != Z_STREAM_END) {
+		n = xread(STDIN_FILENO, in, sizeof(in));
+		if (n <= 0)
+			break;
+		z.next_in = in;
+		z.avail_in = n;
+		do {
+			z.next_out = out;
+			z.avail_out = sizeof(out);
+			status = inflate(&z, Z_NO_FLUSH);
+			/* No progress is possible without more input */
+			if (status == Z_BUF_ERROR)
+				break;
+			if (status != Z_OK && status != Z_STREAM_END)
+				goto out;
+			if (write_in_full(fd, out, sizeof(out) - z.avail_out) < 0) {
+				status = Z_ERRNO;
+				goto out;
+			}
+		} while ((z.avail_in || !z.avail_out) && status != Z_STREAM_END);
+	}
+out:
+	inflateEnd(&z);
+	return status == Z_STREAM_END ? 0 : -1;
+}
+
+/* Run upload-pack for one request of the smart http protocol. Its output
+ * goes straight to stdout, its input is the request body.
+ */
+static int run_upload_pack(struct cgit_context *ctx)
+{
+	struct child_process cld;
+	const char *argv[] = {"git", "upload-pack", "--stateless-rpc", NULL,
+			      NULL};
+	void (*old_sigpipe)(int);
+	int gzipped = 0, err = 0;
+
+	argv[3] = ctx->repo->path;
+	if (ctx->env.http_content_encoding &&
+	    (!strcmp(ctx->env.http_content_encoding, "gzip") ||
+	     !strcmp(ctx->env.http_content_encoding, "x-gzip")))
+		gzipped = 1;
+
+	memset(&cld, 0, sizeof(cld));
+	cld.argv = argv;
+	cld.in = gzipped ? -1 : 0;
+	if (start_command(&cld))
+		return -1;
+	if (gzipped) {
+		/* upload-pack may exit before reading the whole request */
+		old_sigpipe = signal(SIGPIPE, SIG_IGN);
+		err = inflate_request(cld.in);
+		close(cld.in);
+		signal(SIGPIPE, old_sigpipe);
+	}
+	if (finish_command(&cld))
+		err = -1;
+	return err;
+}
+
+/* Append the ref advertisement of upload-pack to `buf` */
+static int fill_upload_pack_refs(struct strbuf *buf)
+{
+	struct child_process cld;
+	const char *argv[] = {"git", "upload-pack", "--stateless-rpc",
+			      "--advertise-refs", NULL, NULL};
+	int err = 0;
+
+	argv[4] = ctx.repo->path;
+	memset(&cld, 0, sizeof(cld));
+	cld.argv = argv;
+	cld.no_stdin = 1;
+	cld.out = -1;
+	if (start_command(&cld))
+		return -1;
+	if (strbuf_read(buf, cld.out, 4096) < 0)
+		err = -1;
+	close(cld.out);
+	if (finish_command(&cld))
+		err = -1;
+	return err;
+}
+
+static void print_service_refs(struct cgit_context *ctx)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (strcmp(ctx->qry.service, "git-upload-pack")) {
+		html_status(403, "Forbidden", 0);
+		return;
+	}
+	strbuf_addstr(&buf, "001e# service=git-upload-pack\n0000");
+	if (cgit_refs_cache("upload-pack", fill_upload_pack_refs, &buf)) {
+		html_status(500, "Internal Server Error", 0);
+		goto out;
+	}
+	ctx->page.mimetype = "application/x-git-upload-pack-advertisement";
+	ctx->page.charset = NULL;
+	ctx->page.expires = ctx->page.modified;
+	ctx->page.size = buf.len;
 	cgit_print_http_headers(ctx);
-	html_include(path);
+	html_raw(buf.buf, buf.len);
+out:
+	strbuf_release(&buf);
 }
 
 void cgit_clone_info(struct cgit_context *ctx)
 {
+	struct strbuf buf = STRBUF_INIT;
+
 	if (!ctx->qry.path || strcmp(ctx->qry.path, "refs"))
 		return;
 
+	if (ctx->qry.service && ctx->repo->enable_smart_http) {
+		print_service_refs(ctx);
+		return;
+	}
+
+	cgit_refs_cache("info", fill_ref_info, &buf);
 	ctx->page.mimetype = "text/plain";
 	ctx->page.filename = "info/refs";
+	ctx->page.size = buf.len;
 	cgit_print_http_headers(ctx);
-	for_each_ref(print_ref_info, ctx);
+	html_raw(buf.buf, buf.len);
+	strbuf_release(&buf);
 }
 
 void cgit_clone_objects(struct cgit_context *ctx)
@@ -100,3 +339,26 @@ void cgit_clone_head(struct cgit_context *ctx)
 {
 	send_file(ctx, git_path("%s", "HEAD"));
 }
+
+void cgit_clone_upload_pack(struct cgit_context *ctx)
+{
+	if (!ctx->repo->enable_smart_http) {
+		html_status(404, "Not found", 0);
+		return;
+	}
+	if (!ctx->env.request_method ||
+	    strcmp(ctx->env.request_method, "POST")) {
+		html_status(405, "Method Not Allowed", 0);
+		return;
+	}
+	if (!ctx->env.content_type || strcmp(ctx->env.content_type,
+			"application/x-git-upload-pack-request")) {
+		html_status(415, "Unsupported Media Type", 0);
+		return;
+	}
+	ctx->page.mimetype = "application/x-git-upload-pack-result";
+	ctx->page.charset = NULL;
+	ctx->page.expires = ctx->page.modified;
+	cgit_print_http_headers(ctx);
+	run_upload_pack(ctx);
+}
@@ -4,5 +4,6 @@
 void cgit_clone_info(struct cgit_context *ctx);
 void cgit_clone_objects(struct cgit_context *ctx);
 void cgit_clone_head(struct cgit_context *ctx);
+void cgit_clone_upload_pack(struct cgit_context *ctx);
 
 #endif /* UI_CLONE_H */
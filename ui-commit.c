@@ -98,7 +98,8 @@ void cgit_print_commit(char *hex, const char *prefix)
 		     "<td colspan='2' class='sha1'>");
 		tmp = tmp2 = sha1_to_hex(p->item->object.sha1);
 		if (ctx.repo->enable_subject_links) {
-			parent_info = cgit_parse_commit(parent);
+			parent_info = cgit_parse_commit_fields(parent,
+				COMMIT_PARSE_SUBJECT);
 			tmp2 = parent_info->subject;
 		}
 		cgit_commit_link(tmp2, NULL, NULL, ctx.qry.head, tmp, prefix, 0);
@@ -18,6 +18,27 @@ static int files, slots;
 static int total_adds, total_rems, max_changes;
 static int lines_added, lines_removed;
 
+/* While the diffstat is computed, the diff lines of each file are kept
+ * (each as a length followed by the line, ending with a zero length) until
+ * `retain_budget` bytes are used up, so the diff can be printed without
+ * running xdiff again.
+ */
+static size_t retain_budget;
+static struct strbuf retained = STRBUF_INIT;
+static int retaining;
+static int replay_pos;
+
+/* The budgets of "max-diff-files", "max-diff-lines" and "max-diff-time".
+ * Files beyond them are listed in the diffstat, but their diffs are
+ * replaced by a link to the diff of the single file.
+ */
+static const char *diff_prefix;
+static time_t diff_start;
+static int diff_files_shown;
+static int diff_lines_shown;
+static int diff_truncated;
+static linediff_fn guarded_fn;
+
 static struct fileinfo {
 	char status;
 	unsigned char old_sha1[20];
@@ -31,6 +52,8 @@ static struct fileinfo {
 	unsigned long old_size;
 	unsigned long new_size;
 	int binary:1;
+	int skipped:1;
+	char *diff;
 } *items;
 
 static int use_ssdiff = 0;
@@ -91,6 +114,11 @@ static void print_fileinfo(struct fileinfo *info)
 		      info->status == DIFF_STATUS_COPIED ? "copied" : "renamed",
 		      info->old_path);
 	html("</td><td class='right'>");
+	if (info->skipped) {
+		htmlf("-</td><td class='graph'>%lu -> %lu bytes",
+		      info->old_size, info->new_size);
+		return;
+	}
 	if (info->binary) {
 		htmlf("bin</td><td class='graph'>%d -> %d bytes",
 		      info->old_size, info->new_size);
@@ -108,7 +136,45 @@ static void print_fileinfo(struct fileinfo *info)
 	html("</tr></table></td></tr>\n");
 }
 
-static void count_diff_lines(char *line, int len)
+/* The budgets do not apply to a diff limited to the file itself */
+static int diff_guarded(struct diff_filepair *pair)
+{
+	return !diff_prefix || (strcmp(diff_prefix, pair->one->path) &&
+				strcmp(diff_prefix, pair->two->path));
+}
+
+static int diff_time_exceeded(void)
+{
+	return ctx.cfg.max_diff_time &&
+		time(NULL) - diff_start >= ctx.cfg.max_diff_time;
+}
+
+static unsigned long blob_size(const unsigned char *sha1, unsigned mode)
+{
+	unsigned long size = 0;
+
+	if (is_null_sha1(sha1) || S_ISGITLINK(mode) ||
+	    sha1_object_info(sha1, &size) != OBJ_BLOB)
+		return 0;
+	return size;
+}
+
+/* Return non-zero if either side of `pair` is beyond "max-diff-file-size",
+ * storing the sizes of both sides.
+ */
+static int file_too_large(struct diff_filepair *pair,
+			  unsigned long *old_size, unsigned long *new_size)
+{
+	unsigned long limit = (unsigned long)ctx.cfg.max_diff_file_size * 1024;
+
+	if (!ctx.cfg.max_diff_file_size || !diff_guarded(pair))
+		return 0;
+	*old_size = blob_size(pair->one->sha1, pair->one->mode);
+	*new_size = blob_size(pair->two->sha1, pair->two->mode);
+	return *old_size > limit || *new_size > limit;
+}
+
+static void retain_line(char *line, int len)
 {
 	if (line && (len > 0)) {
 		if (line[0] == '+')
@@ -116,6 +182,14 @@ static void count_diff_lines(char *line, int len)
 		else if (line[0] == '-')
 			lines_removed++;
 	}
+	if (!retaining)
+		return;
+	if (retained.len + 2 * sizeof(len) + len > retain_budget) {
+		retaining = 0;
+		return;
+	}
+	strbuf_add(&retained, &len, sizeof(len));
+	strbuf_add(&retained, line, len);
 }
 
 static void inspect_filepair(struct diff_filepair *pair)
@@ -123,11 +197,37 @@ static void inspect_filepair(struct diff_filepair *pair)
 	int binary = 0;
 	unsigned long old_size = 0;
 	unsigned long new_size = 0;
+	char *diff = NULL;
+	int err, end = 0, skipped = 0;
 	files++;
 	lines_added = 0;
 	lines_removed = 0;
-	cgit_diff_files(pair->one->sha1, pair->two->sha1, &old_size, &new_size,
-			&binary, 0, ctx.qry.ignorews, count_diff_lines);
+	if (file_too_large(pair, &old_size, &new_size) ||
+	    (diff_guarded(pair) && diff_time_exceeded())) {
+		skipped = 1;
+		if (!old_size && !new_size) {
+			old_size = blob_size(pair->one->sha1, pair->one->mode);
+			new_size = blob_size(pair->two->sha1, pair->two->mode);
+		}
+	} else if (retain_budget) {
+		retaining = 1;
+		err = cgit_diff_files(pair->one->sha1, pair->two->sha1,
+				      &old_size, &new_size, &binary,
+				      ctx.qry.context, ctx.qry.ignorews,
+				      retain_line);
+		if (!retaining)
+			retain_budget = 0;
+		if (retaining && !err) {
+			strbuf_add(&retained, &end, sizeof(end));
+			retain_budget -= retained.len;
+			diff = strbuf_detach(&retained, NULL);
+		}
+		strbuf_release(&retained);
+	} else
+		cgit_diff_files_count(pair->one->sha1, pair->two->sha1,
+				      &old_size, &new_size, &binary,
+				      ctx.qry.ignorews, &lines_added,
+				      &lines_removed);
 	if (files >= slots) {
 		if (slots == 0)
 			slots = 4;
@@ -147,6 +247,8 @@ static void inspect_filepair(struct diff_filepair *pair)
 	items[files-1].old_size = old_size;
 	items[files-1].new_size = new_size;
 	items[files-1].binary = binary;
+	items[files-1].skipped = skipped;
+	items[files-1].diff = diff;
 	if (lines_added + lines_removed > max_changes)
 		max_changes = lines_added + lines_removed;
 	total_adds += lines_added;
@@ -179,6 +281,8 @@ void cgit_print_diffstat(const unsigned char *old_sha1,
 	html("</div>");
 	html("<table summary='diffstat' class='diffstat'>");
 	max_changes = 0;
+	diff_prefix = prefix;
+	diff_start = time(NULL);
 	cgit_diff_tree(old_sha1, new_sha1, inspect_filepair, prefix,
 		       ctx.qry.ignorews);
 	for(i = 0; i<files; i++)
@@ -277,12 +381,93 @@ static void print_ssdiff_link()
 	}
 }
 
+/* Return the diff lines retained for `pair` by inspect_filepair(), if any */
+static struct fileinfo *retained_diff(struct diff_filepair *pair)
+{
+	struct fileinfo *info;
+
+	if (replay_pos >= files)
+		return NULL;
+	info = &items[replay_pos++];
+	if (!info->diff || hashcmp(info->old_sha1, pair->one->sha1) ||
+	    hashcmp(info->new_sha1, pair->two->sha1))
+		return NULL;
+	return info;
+}
+
+static void replay_diff(struct fileinfo *info, linediff_fn fn)
+{
+	char *p = info->diff;
+	int len;
+
+	while (1) {
+		memcpy(&len, p, sizeof(len));
+		if (!len)
+			break;
+		fn(p + sizeof(len), len);
+		p += sizeof(len) + len;
+	}
+	free(info->diff);
+	info->diff = NULL;
+}
+
+/* Print the lines of a guarded diff until "max-diff-lines" or
+ * "max-diff-time" is used up, then drop the rest of the file.
+ */
+static void guarded_line(char *line, int len)
+{
+	if (diff_truncated)
+		return;
+	if ((ctx.cfg.max_diff_lines &&
+	     diff_lines_shown >= ctx.cfg.max_diff_lines) ||
+	    (!(diff_lines_shown & 255) && diff_time_exceeded())) {
+		diff_truncated = 1;
+		return;
+	}
+	diff_lines_shown++;
+	guarded_fn(line, len);
+}
+
+/* Return why the diff of `pair` is not printed, or NULL if it is */
+static const char *suppress_reason(struct diff_filepair *pair)
+{
+	unsigned long old_size = 0, new_size = 0;
+
+	if (!diff_guarded(pair))
+		return NULL;
+	if (ctx.cfg.max_diff_files &&
+	    diff_files_shown >= ctx.cfg.max_diff_files)
+		return "too many files";
+	if (ctx.cfg.max_diff_lines &&
+	    diff_lines_shown >= ctx.cfg.max_diff_lines)
+		return "too many lines";
+	if (diff_time_exceeded())
+		return "time limit reached";
+	if (file_too_large(pair, &old_size, &new_size))
+		return "file too large";
+	return NULL;
+}
+
+static void print_suppressed(struct diff_filepair *pair, const char *reason)
+{
+	if (use_ssdiff)
+		html("<tr><td colspan='4'>");
+	htmlf("Diff %s (%s), ", diff_truncated ? "truncated" : "not shown",
+	      reason);
+	cgit_diff_link("show the diff of this file", NULL, NULL, ctx.qry.head,
+		       ctx.qry.sha1, ctx.qry.sha2, pair->two->path, 0);
+	if (use_ssdiff)
+		html("</td></tr>");
+}
+
 static void filepair_cb(struct diff_filepair *pair)
 {
 	unsigned long old_size = 0;
 	unsigned long new_size = 0;
 	int binary = 0;
 	linediff_fn print_line_fn = print_line;
+	struct fileinfo *info = retained_diff(pair);
+	const char *reason;
 
 	if (use_ssdiff) {
 		cgit_ssdiff_header_begin();
@@ -301,9 +486,29 @@ static void filepair_cb(struct diff_filepair *pair)
 			cgit_ssdiff_footer();
 		return;
 	}
-	if (cgit_diff_files(pair->one->sha1, pair->two->sha1, &old_size,
-			    &new_size, &binary, ctx.qry.context,
-			    ctx.qry.ignorews, print_line_fn))
+	reason = suppress_reason(pair);
+	if (reason) {
+		if (info) {
+			free(info->diff);
+			info->diff = NULL;
+		}
+		print_suppressed(pair, reason);
+		if (use_ssdiff)
+			cgit_ssdiff_footer();
+		return;
+	}
+	if (diff_guarded(pair)) {
+		diff_files_shown++;
+		guarded_fn = print_line_fn;
+		print_line_fn = guarded_line;
+	}
+	if (info) {
+		replay_diff(info, print_line_fn);
+		binary = info->binary;
+	} else if (cgit_diff_files(pair->one->sha1, pair->two->sha1,
+				   &old_size, &new_size, &binary,
+				   ctx.qry.context, ctx.qry.ignorews,
+				   print_line_fn))
 		cgit_print_error("Error running diff");
 	if (binary) {
 		if (use_ssdiff)
@@ -313,6 +518,11 @@ static void filepair_cb(struct diff_filepair *pair)
 	}
 	if (use_ssdiff)
 		cgit_ssdiff_footer();
+	if (diff_truncated) {
+		print_suppressed(pair, diff_time_exceeded() ?
+				 "time limit reached" : "too many lines");
+		diff_truncated = 0;
+	}
 }
 
 void cgit_print_diff(const char *new_rev, const char *old_rev, const char *prefix)
@@ -355,7 +565,9 @@ void cgit_print_diff(const char *new_rev, const char *old_rev, const char *prefi
 		use_ssdiff = 1;
 
 	print_ssdiff_link();
+	retain_budget = (size_t)ctx.cfg.diff_buffer_size * 1024;
 	cgit_print_diffstat(old_rev_sha1, new_rev_sha1, prefix);
+	retain_budget = 0;
 
 	if (use_ssdiff) {
 		html("<table summary='ssdiff' class='ssdiff'>");
@@ -9,33 +9,9 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
-
-int files, add_lines, rem_lines;
-
-void count_lines(char *line, int size)
-{
-	if (size <= 0)
-		return;
-
-	if (line[0] == '+')
-		add_lines++;
-
-	else if (line[0] == '-')
-		rem_lines++;
-}
-
-void inspect_files(struct diff_filepair *pair)
-{
-	unsigned long old_size = 0;
-	unsigned long new_size = 0;
-	int binary = 0;
-
-	files++;
-	if (ctx.repo->enable_log_linecount)
-		cgit_diff_files(pair->one->sha1, pair->two->sha1, &old_size,
-				&new_size, &binary, 0, ctx.qry.ignorews,
-				count_lines);
-}
+#include "commit-index.h"
+#include "commit-graph.h"
+#include "diffstat.h"
 
 void show_commit_decorations(struct commit *commit)
 {
@@ -76,13 +52,21 @@ void show_commit_decorations(struct commit *commit)
 	}
 }
 
-void print_commit(struct commit *commit)
+/* Print a log row for `commit`. If `info` is NULL, the commit is parsed
+ * for the needed fields. The commitinfo is freed when done.
+ */
+void print_commit(struct commit *commit, struct commitinfo *info)
 {
-	struct commitinfo *info;
+	struct cgit_diffstat stat;
 	char *tmp;
-	int cols = 2;
+	int cols = 2, fields;
 
-	info = cgit_parse_commit(commit);
+	if (!info) {
+		fields = COMMIT_PARSE_AUTHOR | COMMIT_PARSE_SUBJECT;
+		if (ctx.qry.showmsg)
+			fields |= COMMIT_PARSE_MSG;
+		info = cgit_parse_commit_fields(commit, fields);
+	}
 	htmlf("<tr%s><td>",
 		ctx.qry.showmsg ? " class='logheader'" : "");
 	tmp = fmt("id=%s", sha1_to_hex(commit->object.sha1));
@@ -98,15 +82,13 @@ void print_commit(struct commit *commit)
 	html("</td><td>");
 	html_txt(info->author);
 	if (ctx.repo->enable_log_filecount) {
-		files = 0;
-		add_lines = 0;
-		rem_lines = 0;
-		cgit_diff_commit(commit, inspect_files);
+		cgit_commit_diffstat(commit, ctx.repo->enable_log_linecount,
+				     &stat);
 		html("</td><td>");
-		htmlf("%d", files);
+		htmlf("%d", stat.files);
 		if (ctx.repo->enable_log_linecount) {
 			html("</td><td>");
-			htmlf("-%d/+%d", rem_lines, add_lines);
+			htmlf("-%d/+%d", stat.removed, stat.added);
 		}
 	}
 	html("</td></tr>\n");
@@ -148,14 +130,101 @@ static const char *disambiguate_ref(const char *ref)
 	return ref;
 }
 
+/* Print the [prev] and [next] links. If `after` is set, the next page
+ * continues the walk from that cursor instead of skipping `ofs` commits.
+ */
+static void print_pager(int ofs, int cnt, int more, const char *after)
+{
+	html("</table><div class='pager'>");
+	if (ofs > 0) {
+		cgit_log_link("[prev]", NULL, NULL, ctx.qry.head,
+			      ctx.qry.sha1, ctx.qry.vpath,
+			      ofs - cnt, ctx.qry.grep,
+			      ctx.qry.search, ctx.qry.showmsg);
+		html("&nbsp;");
+	}
+	if (more) {
+		cgit_log_cursor_link("[next]", NULL, NULL, ctx.qry.head,
+				     ctx.qry.sha1, ctx.qry.vpath,
+				     ofs + cnt, after, ctx.qry.grep,
+				     ctx.qry.search, ctx.qry.showmsg);
+	}
+	html("</div>");
+}
+
+static void print_more_link(void)
+{
+	html("<tr class='nohover'><td colspan='3'>");
+	cgit_log_link("[...]", NULL, NULL, ctx.qry.head, NULL,
+		      ctx.qry.vpath, 0, NULL, NULL, ctx.qry.showmsg);
+	html("</td></tr>\n");
+}
+
+/* Print the log rows for an unfiltered log starting at `rev` from the
+ * log index, if the index covers it. Return 0 if the log was printed.
+ */
+static int print_indexed_log(const char *rev, int ofs, int cnt, int pager)
+{
+	struct commit_index *idx;
+	struct commit_index_branch branch;
+	struct commit_index_entry entry;
+	struct commitinfo *info;
+	struct commit *commit;
+	unsigned char sha1[20];
+	uint32_t i;
+
+	if (ctx.qry.showmsg || get_sha1(rev, sha1))
+		return -1;
+	idx = cgit_open_commit_index();
+	if (!idx)
+		return -1;
+	if (cgit_commit_index_find(idx, sha1, &branch)) {
+		cgit_close_commit_index(idx);
+		return -1;
+	}
+
+	for (i = ofs; i < branch.count && i < ofs + cnt; i++) {
+		cgit_commit_index_get(idx, &branch, i, &entry);
+		commit = lookup_commit(entry.sha1);
+		if (ctx.repo->enable_log_filecount)
+			parse_commit(commit);
+		else if (!commit->object.parsed)
+			commit->date = entry.date;
+		info = xcalloc(1, sizeof(*info));
+		info->commit = commit;
+		info->author = xstrdup(entry.author);
+		info->subject = xstrdup(entry.subject);
+		print_commit(commit, info);
+	}
+	if (pager)
+		print_pager(ofs, cnt, ofs + cnt < branch.count, NULL);
+	else if (ofs + cnt < branch.count)
+		print_more_link();
+	cgit_close_commit_index(idx);
+	return 0;
+}
+
+/* The largest number of pending commits a [next] cursor may name */
+#define LOG_CURSOR_MAX 8
+
+static struct commit *next_commit(struct rev_info *rev, struct graph_walk *walk)
+{
+	if (walk)
+		return cgit_graph_walk_next(walk);
+	return get_revision(rev);
+}
+
 void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern,
 		    char *path, int pager)
 {
 	struct rev_info rev;
+	struct graph_walk walk, *gw = NULL;
 	struct commit *commit;
+	struct strbuf cursor = STRBUF_INIT;
 	const char *argv[] = {NULL, NULL, NULL, NULL, NULL};
+	const char *after = NULL;
 	int argc = 2;
-	int i, columns = 3;
+	int i, skip;
 
 	if (!tip)
 		tip = ctx.qry.head;
@@ -174,17 +243,7 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 		argv[argc++] = "--";
 		argv[argc++] = path;
 	}
-	init_revisions(&rev, NULL);
-	rev.abbrev = DEFAULT_ABBREV;
-	rev.commit_format = CMIT_FMT_DEFAULT;
-	rev.verbose_header = 1;
-	rev.show_root_diff = 0;
-	setup_revisions(argc, argv, &rev, NULL);
 	load_ref_decorations(DECORATE_FULL_REFS);
-	rev.show_decorations = 1;
-	rev.grep_filter.regflags |= REG_ICASE;
-	compile_grep_patterns(&rev.grep_filter);
-	prepare_revision_walk(&rev);
 
 	if (pager)
 		html("<table class='list nowrap'>");
@@ -193,61 +252,75 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 	      "<th class='left'>Commit message");
 	if (pager) {
 		html(" (");
-		cgit_log_link(ctx.qry.showmsg ? "Collapse" : "Expand", NULL,
-			      NULL, ctx.qry.head, ctx.qry.sha1,
-			      ctx.qry.vpath, ctx.qry.ofs, ctx.qry.grep,
-			      ctx.qry.search, ctx.qry.showmsg ? 0 : 1);
+		cgit_log_cursor_link(ctx.qry.showmsg ? "Collapse" : "Expand",
+				     NULL, NULL, ctx.qry.head, ctx.qry.sha1,
+				     ctx.qry.vpath, ctx.qry.ofs, ctx.qry.after,
+				     ctx.qry.grep, ctx.qry.search,
+				     ctx.qry.showmsg ? 0 : 1);
 		html(")");
 	}
 	html("</th><th class='left'>Author</th>");
 	if (ctx.repo->enable_log_filecount) {
 		html("<th class='left'>Files</th>");
-		columns++;
-		if (ctx.repo->enable_log_linecount) {
+		if (ctx.repo->enable_log_linecount)
 			html("<th class='left'>Lines</th>");
-			columns++;
-		}
 	}
 	html("</tr>\n");
 
 	if (ofs<0)
 		ofs = 0;
+	skip = ofs;
+
+	if (argc == 2 && !ctx.qry.after &&
+	    !print_indexed_log(argv[1], ofs, cnt, pager))
+		return;
+
+	/* Without a grep filter, the commit graph walker is used if the
+	 * repo has a commit graph. It can continue from a cursor instead of
+	 * skipping `ofs` commits.
+	 */
+	if (argc == (path ? 4 : 2)) {
+		if (ctx.qry.after &&
+		    !cgit_graph_walk_resume(&walk, ctx.qry.after, path)) {
+			gw = &walk;
+			skip = 0;
+		} else if (!cgit_graph_walk_setup(&walk, argv[1], path))
+			gw = &walk;
+	}
+	if (!gw) {
+		init_revisions(&rev, NULL);
+		rev.abbrev = DEFAULT_ABBREV;
+		rev.commit_format = CMIT_FMT_DEFAULT;
+		rev.verbose_header = 1;
+		rev.show_root_diff = 0;
+		setup_revisions(argc, argv, &rev, NULL);
+		rev.show_decorations = 1;
+		rev.grep_filter.regflags |= REG_ICASE;
+		compile_grep_patterns(&rev.grep_filter);
+		prepare_revision_walk(&rev);
+	}
 
-	for (i = 0; i < ofs && (commit = get_revision(&rev)) != NULL; i++) {
+	for (i = 0; i < skip && (commit = next_commit(&rev, gw)) != NULL; i++) {
 		free(commit->buffer);
 		commit->buffer = NULL;
 		free_commit_list(commit->parents);
 		commit->parents = NULL;
 	}
 
-	for (i = 0; i < cnt && (commit = get_revision(&rev)) != NULL; i++) {
-		print_commit(commit);
+	for (i = 0; i < cnt && (commit = next_commit(&rev, gw)) != NULL; i++) {
+		print_commit(commit, NULL);
 		free(commit->buffer);
 		commit->buffer = NULL;
 		free_commit_list(commit->parents);
 		commit->parents = NULL;
 	}
 	if (pager) {
-		htmlf("</table><div class='pager'>",
-		     columns);
-		if (ofs > 0) {
-			cgit_log_link("[prev]", NULL, NULL, ctx.qry.head,
-				      ctx.qry.sha1, ctx.qry.vpath,
-				      ofs - cnt, ctx.qry.grep,
-				      ctx.qry.search, ctx.qry.showmsg);
-			html("&nbsp;");
-		}
-		if ((commit = get_revision(&rev)) != NULL) {
-			cgit_log_link("[next]", NULL, NULL, ctx.qry.head,
-				      ctx.qry.sha1, ctx.qry.vpath,
-				      ofs + cnt, ctx.qry.grep,
-				      ctx.qry.search, ctx.qry.showmsg);
-		}
-		html("</div>");
-	} else if ((commit = get_revision(&rev)) != NULL) {
-		html("<tr class='nohover'><td colspan='3'>");
-		cgit_log_link("[...]", NULL, NULL, ctx.qry.head, NULL,
-			      ctx.qry.vpath, 0, NULL, NULL, ctx.qry.showmsg);
-		html("</td></tr>\n");
-	}
+		if (gw && !cgit_graph_walk_cursor(gw, &cursor, LOG_CURSOR_MAX))
+			after = cursor.buf;
+		print_pager(ofs, cnt, next_commit(&rev, gw) != NULL, after);
+	} else if ((commit = next_commit(&rev, gw)) != NULL)
+		print_more_link();
+	if (gw)
+		cgit_graph_walk_release(gw);
+	strbuf_release(&cursor);
 }
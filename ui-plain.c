@@ -9,6 +9,7 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "object-stream.h"
 
 __attribute__((format (printf,1,2)))
 static void not_found(const char *format, ...);
@@ -83,7 +84,9 @@ static void print_gitlink(const unsigned char *sha1, const char *path)
 	ctx.page.mimetype = "text/plain";
 	ctx.page.filename = fmt("%s", path);
 	ctx.page.size = strlen("gitlink: ") + 40;
-	ctx.page.etag = sha1_to_hex(sha1);
+	ctx.page.etag = xstrdup(sha1_to_hex(sha1));
+	if (cgit_print_not_modified(&ctx))
+		return;
 	cgit_print_http_headers(&ctx);
 	html("gitlink: ");
 	html(ctx.page.etag);
@@ -91,9 +94,10 @@ static void print_gitlink(const unsigned char *sha1, const char *path)
 
 static void print_object(const unsigned char *sha1, const char *path)
 {
-	enum object_type type;
-	char *buf, *ext, *slash;
-	unsigned long size;
+	struct object_stream st;
+	const char *buf;
+	char *ext, *slash;
+	unsigned long n;
 	struct string_list_item *mime;
 
 	if (ends_with_slash() > 0) {
@@ -104,17 +108,18 @@ static void print_object(const unsigned char *sha1, const char *path)
 	while ((slash = strchr(path, '/')))
 		path = slash + 1;
 
-	type = sha1_object_info(sha1, &size);
-	if (type == OBJ_BAD) {
-		not_found("Bad object: %s", sha1_to_hex(sha1));
+	ctx.page.etag = xstrdup(sha1_to_hex(sha1));
+	if (cgit_print_not_modified(&ctx))
 		return;
-	}
-
-	buf = read_sha1_file(sha1, &type, &size);
-	if (!buf) {
+	if (cgit_open_object_stream(sha1, &st)) {
 		not_found("Object not found: %s", sha1_to_hex(sha1));
 		return;
 	}
+	buf = cgit_peek_object_stream(&st, &n);
+	if (!buf) {
+		not_found("Bad object: %s", sha1_to_hex(sha1));
+		goto out;
+	}
 	ctx.page.mimetype = NULL;
 	ext = strrchr(path, '.');
 	if (ext && *(++ext)) {
@@ -123,16 +128,16 @@ static void print_object(const unsigned char *sha1, const char *path)
 			ctx.page.mimetype = (char *)mime->util;
 	}
 	if (!ctx.page.mimetype) {
-		if (buffer_is_binary(buf, size))
+		if (buffer_is_binary(buf, n))
 			ctx.page.mimetype = "application/octet-stream";
 		else
 			ctx.page.mimetype = "text/plain";
 	}
 	ctx.page.filename = fmt("%s", path);
-	ctx.page.size = size;
-	ctx.page.etag = sha1_to_hex(sha1);
-	cgit_print_http_headers(&ctx);
-	html_raw(buf, size);
+	ctx.page.size = st.size;
+	cgit_print_http_ranged(&ctx, cgit_object_stream_range, &st);
+out:
+	cgit_close_object_stream(&st);
 }
 
 static void print_dir(const unsigned char *sha1, const char *path)
@@ -155,7 +160,9 @@ static void print_dir(const unsigned char *sha1, const char *path)
 		return;
 	}
 
-	ctx.page.etag = sha1_to_hex(sha1);
+	ctx.page.etag = xstrdup(sha1_to_hex(sha1));
+	if (cgit_print_not_modified(&ctx))
+		return;
 	cgit_print_http_headers(&ctx);
 	html("<html><head><title>");
 	html_txt(path);
@@ -9,6 +9,8 @@
 #include "cgit.h"
 #include "cmd.h"
 #include "html.h"
+#include "refs-cache.h"
+#include "ui-shared.h"
 
 const char cgit_doctype[] =
 "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\"\n"
@@ -283,9 +285,10 @@ void cgit_plain_link(const char *name, const char *title, const char *class,
 	reporevlink("plain", name, title, class, head, rev, path);
 }
 
-void cgit_log_link(const char *name, const char *title, const char *class,
-		   const char *head, const char *rev, const char *path,
-		   int ofs, const char *grep, const char *pattern, int showmsg)
+static void log_link(const char *name, const char *title, const char *class,
+		     const char *head, const char *rev, const char *path,
+		     int ofs, const char *after, const char *grep,
+		     const char *pattern, int showmsg)
 {
 	char *delim;
 	int ishead = 1;
@@ -313,6 +316,12 @@ void cgit_log_link(const char *name, const char *title, const char *class,
 		htmlf("%d", ofs);
 		delim = "&";
 	}
+	if (after) {
+		html(delim);
+		html("after=");
+		html_url_arg(after);
+		delim = "&";
+	}
 	if (showmsg) {
 		html(delim);
 		html("showmsg=1");
@@ -325,6 +334,24 @@ void cgit_log_link(const char *name, const char *title, const char *class,
 	html("</a>");
 }
 
+void cgit_log_link(const char *name, const char *title, const char *class,
+		   const char *head, const char *rev, const char *path,
+		   int ofs, const char *grep, const char *pattern, int showmsg)
+{
+	log_link(name, title, class, head, rev, path, ofs, NULL, grep,
+		 pattern, showmsg);
+}
+
+/* Like cgit_log_link(), but continue the log at the cursor `after` */
+void cgit_log_cursor_link(const char *name, const char *title,
+			  const char *class, const char *head, const char *rev,
+			  const char *path, int ofs, const char *after,
+			  const char *grep, const char *pattern, int showmsg)
+{
+	log_link(name, title, class, head, rev, path, ofs, after, grep,
+		 pattern, showmsg);
+}
+
 void cgit_commit_link(char *name, const char *title, const char *class,
 		      const char *head, const char *rev, const char *path,
 		      int toggle_ssdiff)
@@ -592,6 +619,10 @@ void cgit_print_http_headers(struct cgit_context *ctx)
 		htmlf("Content-Type: %s\n", ctx->page.mimetype);
 	if (ctx->page.size)
 		htmlf("Content-Length: %ld\n", ctx->page.size);
+	if (ctx->page.accept_ranges)
+		html("Accept-Ranges: bytes\n");
+	if (ctx->page.content_range)
+		htmlf("Content-Range: %s\n", ctx->page.content_range);
 	if (ctx->page.filename)
 		htmlf("Content-Disposition: inline; filename=\"%s\"\n",
 		      ctx->page.filename);
@@ -604,6 +635,249 @@ void cgit_print_http_headers(struct cgit_context *ctx)
 		exit(0);
 }
 
+void cgit_commit_etag(struct cgit_context *ctx, const char *rev,
+		      const char *rev2)
+{
+	const char *revs[2];
+	struct commit *commit;
+	unsigned char sha1[20];
+	unsigned long modified = 0;
+	time_t refs_modified;
+	git_SHA_CTX c;
+	int i;
+
+	revs[0] = rev ? rev : ctx->qry.head;
+	revs[1] = rev2;
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, cgit_version, strlen(cgit_version) + 1);
+	if (ctx->qry.raw)
+		git_SHA1_Update(&c, ctx->qry.raw, strlen(ctx->qry.raw) + 1);
+	for (i = 0; i < 2; i++) {
+		if (!revs[i])
+			continue;
+		if (get_sha1(revs[i], sha1))
+			return;
+		commit = lookup_commit_reference(sha1);
+		if (!commit || parse_commit(commit))
+			return;
+		git_SHA1_Update(&c, commit->object.sha1, 20);
+		if (commit->date > modified)
+			modified = commit->date;
+	}
+
+	/* The refs are shown as decorations and in the branch switcher, so
+	 * the page changes whenever one of them does. Their stat data tells
+	 * without reading them.
+	 */
+	cgit_refs_state(sha1, &refs_modified);
+	git_SHA1_Update(&c, sha1, 20);
+	if (refs_modified > modified)
+		modified = refs_modified;
+	git_SHA1_Final(sha1, &c);
+	ctx->page.etag = xstrdup(sha1_to_hex(sha1));
+	ctx->page.modified = modified;
+}
+
+/* Check if the If-None-Match header `list` contains `etag` */
+static int etag_matches(const char *list, const char *etag)
+{
+	const char *p = list, *end;
+	size_t n, len = strlen(etag);
+
+	while (*p) {
+		while (isspace(*p) || *p == ',')
+			p++;
+		if (!prefixcmp(p, "W/"))
+			p += 2;
+		end = strchrnul(p, ',');
+		n = end - p;
+		while (n && isspace(p[n - 1]))
+			n--;
+		if (n == 1 && *p == '*')
+			return 1;
+		if (n == len + 2 && p[0] == '"' && p[len + 1] == '"' &&
+		    !strncmp(p + 1, etag, len))
+			return 1;
+		p = end;
+	}
+	return 0;
+}
+
+int cgit_print_not_modified(struct cgit_context *ctx)
+{
+	char date[64];
+
+	if (!ctx->page.etag || (ctx->env.request_method &&
+				strcmp(ctx->env.request_method, "GET") &&
+				strcmp(ctx->env.request_method, "HEAD")))
+		return 0;
+	if (ctx->env.http_if_none_match) {
+		if (!etag_matches(ctx->env.http_if_none_match, ctx->page.etag))
+			return 0;
+	} else if (ctx->env.http_if_modified_since) {
+		if (parse_date(ctx->env.http_if_modified_since, date,
+			       sizeof(date)) < 0 ||
+		    ctx->page.modified > strtoul(date, NULL, 10))
+			return 0;
+	} else
+		return 0;
+	ctx->page.status = 304;
+	ctx->page.statusmsg = "Not Modified";
+	ctx->page.mimetype = NULL;
+	ctx->page.charset = NULL;
+	ctx->page.filename = NULL;
+	ctx->page.size = 0;
+	ctx->page.accept_ranges = 0;
+	cgit_print_http_headers(ctx);
+	return 1;
+}
+
+#define MAX_RANGES 16
+
+struct http_range {
+	unsigned long first;
+	unsigned long last;
+};
+
+/* Parse the Range header `spec` for a body of `size` bytes, return the
+ * number of satisfiable ranges or -1 if the header is to be ignored.
+ */
+static int parse_ranges(const char *spec, unsigned long size,
+			struct http_range *ranges)
+{
+	const char *p = spec + strlen("bytes=");
+	char *end;
+	unsigned long first, last;
+	int nr = 0, seen = 0;
+
+	if (prefixcmp(spec, "bytes="))
+		return -1;
+	for (;;) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '-' && isdigit(p[1])) {
+			last = strtoul(p + 1, &end, 10);
+			first = last < size ? size - last : 0;
+			last = last ? size - 1 : 0;
+			if (!size)
+				first = 1;
+		} else if (isdigit(*p)) {
+			first = strtoul(p, &end, 10);
+			if (*end != '-')
+				return -1;
+			p = end + 1;
+			if (isdigit(*p)) {
+				last = strtoul(p, &end, 10);
+				if (last < first)
+					return -1;
+			} else {
+				end = (char *)p;
+				last = ULONG_MAX;
+			}
+			if (last >= size)
+				last = size - 1;
+		} else
+			return -1;
+		if (++seen > MAX_RANGES)
+			return -1;
+		if (first < size && first <= last) {
+			ranges[nr].first = first;
+			ranges[nr].last = last;
+			nr++;
+		}
+		p = end;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!*p)
+			return nr;
+		if (*p++ != ',')
+			return -1;
+	}
+}
+
+void cgit_print_http_ranged(struct cgit_context *ctx, cgit_range_fn fn,
+			    void *data)
+{
+	struct http_range ranges[MAX_RANGES];
+	struct strbuf part = STRBUF_INIT;
+	unsigned long size = ctx->page.size;
+	char *boundary, *type;
+	int i, nr = -1;
+
+	ctx->page.accept_ranges = 1;
+	if (ctx->env.http_range &&
+	    (!ctx->env.request_method ||
+	     !strcmp(ctx->env.request_method, "GET")) &&
+	    (!ctx->env.http_if_range || (ctx->page.etag &&
+	     !strcmp(ctx->env.http_if_range, fmt("\"%s\"", ctx->page.etag)))))
+		nr = parse_ranges(ctx->env.http_range, size, ranges);
+	if (nr < 0) {
+		cgit_print_http_headers(ctx);
+		fn(data, htmlfd, 0, size);
+		return;
+	}
+	if (nr == 0) {
+		ctx->page.status = 416;
+		ctx->page.statusmsg = "Requested Range Not Satisfiable";
+		ctx->page.content_range = xstrdup(fmt("bytes */%lu", size));
+		ctx->page.size = 0;
+		cgit_print_http_headers(ctx);
+		return;
+	}
+	ctx->page.status = 206;
+	ctx->page.statusmsg = "Partial Content";
+	if (nr == 1) {
+		ctx->page.content_range = xstrdup(fmt("bytes %lu-%lu/%lu",
+			ranges[0].first, ranges[0].last, size));
+		ctx->page.size = ranges[0].last - ranges[0].first + 1;
+		cgit_print_http_headers(ctx);
+		fn(data, htmlfd, ranges[0].first, ctx->page.size);
+		return;
+	}
+
+	/* Several ranges are sent as the parts of a multipart/byteranges
+	 * body, whose length is known up front.
+	 */
+	boundary = xstrdup(fmt("%08lx%08lx", (unsigned long)time(NULL),
+			       (unsigned long)getpid()));
+	if (ctx->page.mimetype && ctx->page.charset)
+		type = xstrdup(fmt("%s; charset=%s", ctx->page.mimetype,
+				   ctx->page.charset));
+	else
+		type = xstrdup(ctx->page.mimetype ? ctx->page.mimetype :
+			       "application/octet-stream");
+	ctx->page.size = 0;
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&part);
+		strbuf_addf(&part, "\r\n--%s\r\nContent-Type: %s\r\n"
+			    "Content-Range: bytes %lu-%lu/%lu\r\n\r\n",
+			    boundary, type, ranges[i].first, ranges[i].last,
+			    size);
+		ctx->page.size += part.len + ranges[i].last -
+			ranges[i].first + 1;
+	}
+	ctx->page.size += strlen("\r\n----\r\n") + strlen(boundary);
+	ctx->page.mimetype = xstrdup(fmt("multipart/byteranges; boundary=%s",
+					 boundary));
+	ctx->page.charset = NULL;
+	cgit_print_http_headers(ctx);
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&part);
+		strbuf_addf(&part, "\r\n--%s\r\nContent-Type: %s\r\n"
+			    "Content-Range: bytes %lu-%lu/%lu\r\n\r\n",
+			    boundary, type, ranges[i].first, ranges[i].last,
+			    size);
+		html_raw(part.buf, part.len);
+		if (fn(data, htmlfd, ranges[i].first,
+		       ranges[i].last - ranges[i].first + 1))
+			break;
+	}
+	htmlf("\r\n--%s--\r\n", boundary);
+	strbuf_release(&part);
+	free(type);
+	free(boundary);
+}
+
 void cgit_print_docstart(struct cgit_context *ctx)
 {
 	if (ctx->cfg.embedded) {
@@ -27,6 +27,11 @@ extern void cgit_log_link(const char *name, const char *title,
 			  const char *class, const char *head, const char *rev,
 			  const char *path, int ofs, const char *grep,
 			  const char *pattern, int showmsg);
+extern void cgit_log_cursor_link(const char *name, const char *title,
+				 const char *class, const char *head,
+				 const char *rev, const char *path, int ofs,
+				 const char *after, const char *grep,
+				 const char *pattern, int showmsg);
 extern void cgit_commit_link(char *name, const char *title,
 			     const char *class, const char *head,
 			     const char *rev, const char *path,
@@ -55,6 +60,28 @@ extern void cgit_print_error(const char *msg);
 extern void cgit_print_date(time_t secs, const char *format, int local_time);
 extern void cgit_print_age(time_t t, time_t max_relative, const char *format);
 extern void cgit_print_http_headers(struct cgit_context *ctx);
+
+/* Set the ETag and Last-Modified date of a page showing the commit `rev`
+ * (the current head if NULL), and optionally `rev2`. Both also change
+ * whenever a ref does.
+ */
+extern void cgit_commit_etag(struct cgit_context *ctx, const char *rev,
+			     const char *rev2);
+
+/* Print a 304 response and return 1 if the client's copy of the page is
+ * still valid, return 0 otherwise.
+ */
+extern int cgit_print_not_modified(struct cgit_context *ctx);
+
+/* Write `len` bytes from offset `ofs` of the body `data` to `fd` */
+typedef int (*cgit_range_fn)(void *data, int fd, unsigned long ofs,
+			     unsigned long len);
+
+/* Print the headers and the body of ctx->page.size bytes, or only the
+ * ranges of it requested by a Range header.
+ */
+extern void cgit_print_http_ranged(struct cgit_context *ctx,
+				   cgit_range_fn fn, void *data);
 extern void cgit_print_docstart(struct cgit_context *ctx);
 extern void cgit_print_docend();
 extern void cgit_print_pageheader(struct cgit_context *ctx);
@@ -9,6 +9,7 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "snapshot-cache.h"
 
 static int write_compressed_tar_archive(struct archiver_args *args,const char *filter)
 {
@@ -84,7 +85,7 @@ static int make_snapshot(const struct cgit_snapshot_format *format,
 	}
 	memset(&args, 0, sizeof(args));
 	if (prefix) {
-		args.base = fmt("%s/", prefix);
+		args.base = xstrdup(fmt("%s/", prefix));
 		args.baselen = strlen(prefix) + 1;
 	} else {
 		args.base = "";
@@ -95,6 +96,8 @@ static int make_snapshot(const struct cgit_snapshot_format *format,
 	args.compression_level = Z_DEFAULT_COMPRESSION;
 	ctx.page.mimetype = xstrdup(format->mimetype);
 	ctx.page.filename = xstrdup(filename);
+	if (!cgit_print_cached_snapshot(format, &args))
+		return 0;
 	cgit_print_http_headers(&ctx);
 	format->write_func(&args);
 	return 0;
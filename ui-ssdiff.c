@@ -6,59 +6,292 @@ extern int use_ssdiff;
 
 static int current_old_line, current_new_line;
 
-struct deferred_lines {
+/* Removed and added lines are deferred until the end of a block of
+ * changes, so they can be printed side by side. Their text is kept in
+ * deferred_text (NUL-terminated, including the leading '-' or '+'), and
+ * all buffers are reused for the next block.
+ */
+struct deferred_line {
 	int line_no;
-	char *line;
-	struct deferred_lines *next;
+	size_t ofs;
+};
+
+struct deferred_lines {
+	struct deferred_line *lines;
+	int nr;
+	int alloc;
 };
 
-static struct deferred_lines *deferred_old, *deferred_old_last;
-static struct deferred_lines *deferred_new, *deferred_new_last;
+static struct deferred_lines deferred_old, deferred_new;
+static struct strbuf deferred_text = STRBUF_INIT;
+
+/* Tab-expanded lines and intraline flags of the line pair being printed */
+static struct strbuf old_buf = STRBUF_INIT, new_buf = STRBUF_INIT;
+static char *old_common, *new_common;
+static size_t old_common_alloc, new_common_alloc;
+
+/* An intraline diff marks the tokens of a line pair which are part of a
+ * longest common subsequence. Tokens are single characters, or words,
+ * runs of whitespace and single punctuation characters if
+ * "intraline-diff" is set to "word"; either way they are compared as
+ * integers. The diff uses the linear space variant of
+ * Myers' O((M+N)D) algorithm: the middle snake of an optimal edit path is
+ * found by searching forwards and backwards at the same time, and the
+ * ranges before and after it are diffed recursively. The search vectors
+ * are shared by all levels of the recursion.
+ *
+ * `budget` is the number of steps left. Once it is used up, all ranges
+ * which remain are treated as completely changed.
+ */
+struct intraline {
+	const int *a, *b;
+	char *a_common, *b_common;
+	int *v1, *v2;
+	long budget;
+};
 
-static char *longest_common_subsequence(char *A, char *B)
+/* Find the middle snake of a[0..n) and b[0..m), where neither the first
+ * nor the last characters match, and return a point of it in *x and *y.
+ * Return -1 if the budget ran out or nothing is in common.
+ */
+static int middle_snake(struct intraline *d, const int *a, int n,
+			const int *b, int m, int *x, int *y)
 {
-	int i, j, ri;
-	int m = strlen(A);
-	int n = strlen(B);
-	int L[m + 1][n + 1];
-	int tmp1, tmp2;
-	int lcs_length;
-	char *result;
-
-	for (i = m; i >= 0; i--) {
-		for (j = n; j >= 0; j--) {
-			if (A[i] == '\0' || B[j] == '\0') {
-				L[i][j] = 0;
-			} else if (A[i] == B[j]) {
-				L[i][j] = 1 + L[i + 1][j + 1];
-			} else {
-				tmp1 = L[i + 1][j];
-				tmp2 = L[i][j + 1];
-				L[i][j] = (tmp1 > tmp2 ? tmp1 : tmp2);
+	int max_d = (n + m + 1) / 2, v_len = 2 * max_d + 2, v_ofs = max_d;
+	int delta = n - m, front = delta & 1;
+	int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+	int *v1 = d->v1, *v2 = d->v2;
+	int i, k1, k2, k1_ofs, k2_ofs, x1, y1, x2, y2, x0;
+
+	for (i = 0; i < v_len; i++)
+		v1[i] = v2[i] = -1;
+	v1[v_ofs + 1] = v2[v_ofs + 1] = 0;
+	for (i = 0; i < max_d; i++) {
+		d->budget -= 2 * i + 2;
+		if (d->budget < 0)
+			return -1;
+		for (k1 = -i + k1start; k1 <= i - k1end; k1 += 2) {
+			k1_ofs = v_ofs + k1;
+			if (k1 == -i ||
+			    (k1 != i && v1[k1_ofs - 1] < v1[k1_ofs + 1]))
+				x1 = v1[k1_ofs + 1];
+			else
+				x1 = v1[k1_ofs - 1] + 1;
+			y1 = x1 - k1;
+			x0 = x1;
+			while (x1 < n && y1 < m && a[x1] == b[y1]) {
+				x1++;
+				y1++;
+			}
+			d->budget -= x1 - x0;
+			v1[k1_ofs] = x1;
+			if (x1 > n)
+				k1end += 2;
+			else if (y1 > m)
+				k1start += 2;
+			else if (front) {
+				k2_ofs = v_ofs + delta - k1;
+				if (k2_ofs >= 0 && k2_ofs < v_len &&
+				    v2[k2_ofs] != -1 && x1 >= n - v2[k2_ofs]) {
+					*x = x1;
+					*y = y1;
+					return 0;
+				}
+			}
+		}
+		for (k2 = -i + k2start; k2 <= i - k2end; k2 += 2) {
+			k2_ofs = v_ofs + k2;
+			if (k2 == -i ||
+			    (k2 != i && v2[k2_ofs - 1] < v2[k2_ofs + 1]))
+				x2 = v2[k2_ofs + 1];
+			else
+				x2 = v2[k2_ofs - 1] + 1;
+			y2 = x2 - k2;
+			x0 = x2;
+			while (x2 < n && y2 < m &&
+			       a[n - x2 - 1] == b[m - y2 - 1]) {
+				x2++;
+				y2++;
+			}
+			d->budget -= x2 - x0;
+			v2[k2_ofs] = x2;
+			if (x2 > n)
+				k2end += 2;
+			else if (y2 > m)
+				k2start += 2;
+			else if (!front) {
+				k1_ofs = v_ofs + delta - k2;
+				if (k1_ofs >= 0 && k1_ofs < v_len &&
+				    v1[k1_ofs] != -1 && v1[k1_ofs] >= n - x2) {
+					*x = v1[k1_ofs];
+					*y = v_ofs + v1[k1_ofs] - k1_ofs;
+					return 0;
+				}
 			}
 		}
 	}
+	return -1;
+}
 
-	lcs_length = L[0][0];
-	result = xmalloc(lcs_length + 2);
-	memset(result, 0, sizeof(*result) * (lcs_length + 2));
-
-	ri = 0;
-	i = 0;
-	j = 0;
-	while (i < m && j < n) {
-		if (A[i] == B[j]) {
-			result[ri] = A[i];
-			ri += 1;
-			i += 1;
-			j += 1;
-		} else if (L[i + 1][j] >= L[i][j + 1]) {
-			i += 1;
-		} else {
-			j += 1;
-		}
+static void intraline_range(struct intraline *d, int a_ofs, int n,
+			    int b_ofs, int m)
+{
+	int x, y;
+
+	while (n && m && d->a[a_ofs] == d->b[b_ofs]) {
+		d->a_common[a_ofs++] = 1;
+		d->b_common[b_ofs++] = 1;
+		n--;
+		m--;
+	}
+	while (n && m && d->a[a_ofs + n - 1] == d->b[b_ofs + m - 1]) {
+		d->a_common[a_ofs + --n] = 1;
+		d->b_common[b_ofs + --m] = 1;
+	}
+	if (!n || !m || d->budget < 0)
+		return;
+	if (middle_snake(d, d->a + a_ofs, n, d->b + b_ofs, m, &x, &y) ||
+	    (!x && !y) || (x == n && y == m))
+		return;
+	intraline_range(d, a_ofs, x, b_ofs, y);
+	intraline_range(d, a_ofs + x, n - x, b_ofs + y, m - y);
+}
+
+/* The tokens of a line: their numbers, which are equal for equal tokens,
+ * and their offsets, followed by the length of the line.
+ */
+struct line_tokens {
+	int nr;
+	int *id;
+	int *start;
+};
+
+struct token_slot {
+	const char *tok;
+	int len;
+	int id;
+};
+
+/* Token numbers for the words of a line pair, found through an open
+ * addressing hash table of `size` slots (a power of two). Numbers below
+ * 256 are left for single characters.
+ */
+struct token_table {
+	struct token_slot *slot;
+	int size;
+	int nr;
+};
+
+static int is_word_char(unsigned char c)
+{
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static int token_len(const char *p)
+{
+	const char *q = p + 1;
+
+	if (is_word_char(*p))
+		while (is_word_char(*q))
+			q++;
+	else if (isspace((unsigned char)*p))
+		while (*q && isspace((unsigned char)*q))
+			q++;
+	return q - p;
+}
+
+static int token_id(struct token_table *table, const char *tok, int len)
+{
+	struct token_slot *slot;
+	unsigned long hash = 0x811c9dc5;
+	int i;
+
+	if (len == 1)
+		return (unsigned char)*tok;
+	for (i = 0; i < len; i++)
+		hash = (hash * 0x01000193) ^ (unsigned char)tok[i];
+	i = hash & (table->size - 1);
+	while ((slot = &table->slot[i])->tok) {
+		if (slot->len == len && !memcmp(slot->tok, tok, len))
+			return slot->id;
+		i = (i + 1) & (table->size - 1);
 	}
-	return result;
+	slot->tok = tok;
+	slot->len = len;
+	slot->id = table->nr++;
+	return slot->id;
+}
+
+/* Split a line into tokens, or into single characters if `table` is NULL */
+static void tokenize(const char *line, struct token_table *table,
+		     struct line_tokens *t)
+{
+	int i, n = strlen(line), len;
+
+	t->nr = 0;
+	t->id = xmalloc((n + 1) * sizeof(int));
+	t->start = xmalloc((n + 1) * sizeof(int));
+	for (i = 0; i < n; i += len) {
+		len = table ? token_len(line + i) : 1;
+		t->id[t->nr] = table ? token_id(table, line + i, len) :
+			(unsigned char)line[i];
+		t->start[t->nr++] = i;
+	}
+	t->start[t->nr] = n;
+}
+
+/* Set the flags in a_common and b_common for the characters of `a` and `b`
+ * which are part of unchanged tokens.
+ */
+static void intraline_diff(const char *a, const char *b, char *a_common,
+			   char *b_common)
+{
+	struct intraline d;
+	struct token_table table, *words = NULL;
+	struct line_tokens ta, tb;
+	char *ta_common, *tb_common;
+	int i;
+
+	if (ctx.cfg.intraline_words) {
+		table.size = 16;
+		while (table.size < 2 * (strlen(a) + strlen(b)))
+			table.size *= 2;
+		table.slot = xcalloc(table.size, sizeof(struct token_slot));
+		table.nr = 256;
+		words = &table;
+	}
+	tokenize(a, words, &ta);
+	tokenize(b, words, &tb);
+	ta_common = xcalloc(ta.nr + 1, 1);
+	tb_common = xcalloc(tb.nr + 1, 1);
+
+	d.a = ta.id;
+	d.b = tb.id;
+	d.a_common = ta_common;
+	d.b_common = tb_common;
+	d.v1 = xmalloc((ta.nr + tb.nr + 4) * sizeof(int));
+	d.v2 = xmalloc((ta.nr + tb.nr + 4) * sizeof(int));
+	d.budget = ctx.cfg.max_ssdiff_cost > 0 ? ctx.cfg.max_ssdiff_cost :
+		LONG_MAX;
+	intraline_range(&d, 0, ta.nr, 0, tb.nr);
+
+	for (i = 0; i < ta.nr; i++)
+		memset(a_common + ta.start[i], ta_common[i],
+		       ta.start[i + 1] - ta.start[i]);
+	for (i = 0; i < tb.nr; i++)
+		memset(b_common + tb.start[i], tb_common[i],
+		       tb.start[i + 1] - tb.start[i]);
+
+	free(d.v1);
+	free(d.v2);
+	free(ta_common);
+	free(tb_common);
+	free(ta.id);
+	free(ta.start);
+	free(tb.id);
+	free(tb.start);
+	if (words)
+		free(table.slot);
 }
 
 static int line_from_hunk(char *line, char type)
@@ -82,105 +315,68 @@ static int line_from_hunk(char *line, char type)
 	return res;
 }
 
-static char *replace_tabs(char *line)
+/* Expand the tabs of `line` into `out`, which is reset first */
+static char *expand_tabs(struct strbuf *out, const char *line)
 {
-	char *prev_buf = line;
-	char *cur_buf;
-	int linelen = strlen(line);
-	int n_tabs = 0;
-	int i;
-	char *result;
-	char *spaces = "        ";
-
-	if (linelen == 0) {
-		result = xmalloc(1);
-		result[0] = '\0';
-		return result;
-	}
-
-	for (i = 0; i < linelen; i++)
-		if (line[i] == '\t')
-			n_tabs += 1;
-	result = xmalloc(linelen + n_tabs * 8 + 1);
-	result[0] = '\0';
-
-	while (1) {
-		cur_buf = strchr(prev_buf, '\t');
-		if (!cur_buf) {
-			strcat(result, prev_buf);
+	size_t n;
+
+	strbuf_reset(out);
+	while (*line) {
+		n = strcspn(line, "\t");
+		strbuf_add(out, line, n);
+		line += n;
+		if (!*line)
 			break;
-		} else {
-			strcat(result, " ");
-			strncat(result, spaces, 8 - (strlen(result) % 8));
-			strncat(result, prev_buf, cur_buf - prev_buf);
-		}
-		prev_buf = cur_buf + 1;
+		do
+			strbuf_addch(out, ' ');
+		while (out->len % 8);
+		line++;
 	}
-	return result;
+	return out->buf;
 }
 
-static int calc_deferred_lines(struct deferred_lines *start)
+static void deferred_add(struct deferred_lines *list, const char *line,
+			 int len, int line_no)
 {
-	struct deferred_lines *item = start;
-	int result = 0;
-	while (item) {
-		result += 1;
-		item = item->next;
-	}
-	return result;
+	ALLOC_GROW(list->lines, list->nr + 1, list->alloc);
+	list->lines[list->nr].line_no = line_no;
+	list->lines[list->nr].ofs = deferred_text.len;
+	list->nr++;
+	strbuf_add(&deferred_text, line, len);
+	strbuf_addch(&deferred_text, '\0');
 }
 
-static void deferred_old_add(char *line, int line_no)
+static char *deferred_line(struct deferred_lines *list, int i)
 {
-	struct deferred_lines *item = xmalloc(sizeof(struct deferred_lines));
-	item->line = xstrdup(line);
-	item->line_no = line_no;
-	item->next = NULL;
-	if (deferred_old) {
-		deferred_old_last->next = item;
-		deferred_old_last = item;
-	} else {
-		deferred_old = deferred_old_last = item;
-	}
+	return deferred_text.buf + list->lines[i].ofs;
 }
 
-static void deferred_new_add(char *line, int line_no)
+/* Return a zeroed buffer of at least `size` bytes, reusing *buf */
+static char *clear_flags(char **buf, size_t *alloc, size_t size)
 {
-	struct deferred_lines *item = xmalloc(sizeof(struct deferred_lines));
-	item->line = xstrdup(line);
-	item->line_no = line_no;
-	item->next = NULL;
-	if (deferred_new) {
-		deferred_new_last->next = item;
-		deferred_new_last = item;
-	} else {
-		deferred_new = deferred_new_last = item;
-	}
+	ALLOC_GROW(*buf, size, *alloc);
+	memset(*buf, 0, size);
+	return *buf;
 }
 
-static void print_part_with_lcs(char *class, char *line, char *lcs)
+/* Print a line with the runs of changed characters wrapped in spans */
+static void print_part_with_common(char *class, char *line, char *common)
 {
-	int line_len = strlen(line);
-	int i, j;
-	char c[2] = " ";
-	int same = 1;
-
-	j = 0;
-	for (i = 0; i < line_len; i++) {
-		c[0] = line[i];
-		if (same) {
-			if (line[i] == lcs[j])
-				j += 1;
-			else {
-				same = 0;
-				htmlf("<span class='%s'>", class);
-			}
-		} else if (line[i] == lcs[j]) {
-			same = 1;
-			htmlf("</span>");
-			j += 1;
-		}
-		html_txt(c);
+	int i = 0, j;
+	char c;
+
+	while (line[i]) {
+		for (j = i + 1; line[j] && common[j] == common[i]; j++)
+			;
+		c = line[j];
+		line[j] = '\0';
+		if (!common[i])
+			htmlf("<span class='%s'>", class);
+		html_txt(line + i);
+		if (!common[i])
+			html("</span>");
+		line[j] = c;
+		i = j;
 	}
 }
 
@@ -190,13 +386,17 @@ static void print_ssdiff_line(char *class,
 			      int new_line_no,
 			      char *new_line, int individual_chars)
 {
-	char *lcs = NULL;
+	int intraline = individual_chars && old_line && new_line;
+
 	if (old_line)
-		old_line = replace_tabs(old_line + 1);
+		old_line = expand_tabs(&old_buf, old_line + 1);
 	if (new_line)
-		new_line = replace_tabs(new_line + 1);
-	if (individual_chars && old_line && new_line)
-		lcs = longest_common_subsequence(old_line, new_line);
+		new_line = expand_tabs(&new_buf, new_line + 1);
+	if (intraline) {
+		clear_flags(&old_common, &old_common_alloc, old_buf.len + 1);
+		clear_flags(&new_common, &new_common_alloc, new_buf.len + 1);
+		intraline_diff(old_line, new_line, old_common, new_common);
+	}
 	html("<tr>");
 	if (old_line_no > 0)
 		htmlf("<td class='lineno'>%d</td><td class='%s'>",
@@ -206,8 +406,8 @@ static void print_ssdiff_line(char *class,
 	else
 		htmlf("<td class='lineno'></td><td class='%s_dark'>", class);
 	if (old_line) {
-		if (lcs)
-			print_part_with_lcs("del", old_line, lcs);
+		if (intraline)
+			print_part_with_common("del", old_line, old_common);
 		else
 			html_txt(old_line);
 	}
@@ -221,94 +421,72 @@ static void print_ssdiff_line(char *class,
 	else
 		htmlf("<td class='lineno'></td><td class='%s_dark'>", class);
 	if (new_line) {
-		if (lcs)
-			print_part_with_lcs("add", new_line, lcs);
+		if (intraline)
+			print_part_with_common("add", new_line, new_common);
 		else
 			html_txt(new_line);
 	}
 
 	html("</td></tr>");
-	if (lcs)
-		free(lcs);
-	if (new_line)
-		free(new_line);
-	if (old_line)
-		free(old_line);
 }
 
 static void print_deferred_old_lines()
 {
-	struct deferred_lines *iter_old, *tmp;
-	iter_old = deferred_old;
-	while (iter_old) {
-		print_ssdiff_line("del", iter_old->line_no,
-				  iter_old->line, -1, NULL, 0);
-		tmp = iter_old->next;
-		free(iter_old);
-		iter_old = tmp;
-	}
+	int i;
+
+	for (i = 0; i < deferred_old.nr; i++)
+		print_ssdiff_line("del", deferred_old.lines[i].line_no,
+				  deferred_line(&deferred_old, i), -1, NULL, 0);
 }
 
 static void print_deferred_new_lines()
 {
-	struct deferred_lines *iter_new, *tmp;
-	iter_new = deferred_new;
-	while (iter_new) {
+	int i;
+
+	for (i = 0; i < deferred_new.nr; i++)
 		print_ssdiff_line("add", -1, NULL,
-				  iter_new->line_no, iter_new->line, 0);
-		tmp = iter_new->next;
-		free(iter_new);
-		iter_new = tmp;
-	}
+				  deferred_new.lines[i].line_no,
+				  deferred_line(&deferred_new, i), 0);
 }
 
 static void print_deferred_changed_lines()
 {
-	struct deferred_lines *iter_old, *iter_new, *tmp;
-	int n_old_lines = calc_deferred_lines(deferred_old);
-	int n_new_lines = calc_deferred_lines(deferred_new);
-	int individual_chars = (n_old_lines == n_new_lines ? 1 : 0);
-
-	iter_old = deferred_old;
-	iter_new = deferred_new;
-	while (iter_old || iter_new) {
-		if (iter_old && iter_new)
-			print_ssdiff_line("changed", iter_old->line_no,
-					  iter_old->line,
-					  iter_new->line_no, iter_new->line,
+	int individual_chars = (deferred_old.nr == deferred_new.nr);
+	int i;
+
+	for (i = 0; i < deferred_old.nr || i < deferred_new.nr; i++) {
+		if (i < deferred_old.nr && i < deferred_new.nr)
+			print_ssdiff_line("changed",
+					  deferred_old.lines[i].line_no,
+					  deferred_line(&deferred_old, i),
+					  deferred_new.lines[i].line_no,
+					  deferred_line(&deferred_new, i),
 					  individual_chars);
-		else if (iter_old)
-			print_ssdiff_line("changed", iter_old->line_no,
-					  iter_old->line, -1, NULL, 0);
-		else if (iter_new)
+		else if (i < deferred_old.nr)
+			print_ssdiff_line("changed",
+					  deferred_old.lines[i].line_no,
+					  deferred_line(&deferred_old, i),
+					  -1, NULL, 0);
+		else
 			print_ssdiff_line("changed", -1, NULL,
-					  iter_new->line_no, iter_new->line, 0);
-		if (iter_old) {
-			tmp = iter_old->next;
-			free(iter_old);
-			iter_old = tmp;
-		}
-
-		if (iter_new) {
-			tmp = iter_new->next;
-			free(iter_new);
-			iter_new = tmp;
-		}
+					  deferred_new.lines[i].line_no,
+					  deferred_line(&deferred_new, i), 0);
 	}
 }
 
 void cgit_ssdiff_print_deferred_lines()
 {
-	if (!deferred_old && !deferred_new)
+	if (!deferred_old.nr && !deferred_new.nr)
 		return;
-	if (deferred_old && !deferred_new)
+	if (deferred_old.nr && !deferred_new.nr)
 		print_deferred_old_lines();
-	else if (!deferred_old && deferred_new)
+	else if (!deferred_old.nr && deferred_new.nr)
 		print_deferred_new_lines();
 	else
 		print_deferred_changed_lines();
-	deferred_old = deferred_old_last = NULL;
-	deferred_new = deferred_new_last = NULL;
+	deferred_old.nr = 0;
+	deferred_new.nr = 0;
+	strbuf_reset(&deferred_text);
 }
 
 /*
@@ -324,17 +502,17 @@ void cgit_ssdiff_line_cb(char *line, int len)
 	}
 
 	if (line[0] == ' ') {
-		if (deferred_old || deferred_new)
+		if (deferred_old.nr || deferred_new.nr)
 			cgit_ssdiff_print_deferred_lines();
 		print_ssdiff_line("ctx", current_old_line, line,
 				  current_new_line, line, 0);
 		current_old_line += 1;
 		current_new_line += 1;
 	} else if (line[0] == '+') {
-		deferred_new_add(line, current_new_line);
+		deferred_add(&deferred_new, line, len - 1, current_new_line);
 		current_new_line += 1;
 	} else if (line[0] == '-') {
-		deferred_old_add(line, current_old_line);
+		deferred_add(&deferred_old, line, len - 1, current_old_line);
 		current_old_line += 1;
 	} else if (line[0] == '@') {
 		html("<tr><td colspan='4' class='hunk'>");
@@ -363,7 +541,7 @@ void cgit_ssdiff_header_end()
 
 void cgit_ssdiff_footer()
 {
-	if (deferred_old || deferred_new)
+	if (deferred_old.nr || deferred_new.nr)
 		cgit_ssdiff_print_deferred_lines();
 	html("<tr><td class='foot' colspan='4'></td></tr>");
 }
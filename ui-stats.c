@@ -1,15 +1,38 @@
-#include <string-list.h>
-
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
 #include "ui-stats.h"
+#include "commit-graph.h"
+#include "stats-cube.h"
+#include "cache.h"
 
 #define MONTHS 6
 
 struct authorstat {
+	char *name;
+	unsigned long hash;
 	long total;
-	struct string_list list;
+};
+
+/* Commit counts per author per period. The authors are found through an
+ * open addressing hash table of indexes into `authors` (0 is an empty
+ * slot), the counts are a dense matrix with one row of `nr_periods`
+ * counters per author, and commit dates are mapped to periods by their
+ * day number relative to the first day of the first period.
+ */
+struct authorstats {
+	struct authorstat *authors;
+	int nr, alloc;
+	int *table;
+	int table_size;
+	long *counts;
+	int counts_alloc;
+	int nr_periods;
+	char **labels;
+	unsigned long first_day;
+	int nr_days;
+	unsigned char *day_period;
+	int *order;
 };
 
 #define DAY_SECS (60 * 60 * 24)
@@ -162,202 +185,294 @@ const char *cgit_find_stats_periodname(int idx)
 		return "";
 }
 
-static void add_commit(struct string_list *authors, struct commit *commit,
-	struct cgit_period *period)
+static void init_stats(struct authorstats *stats, struct cgit_period *period)
 {
-	struct commitinfo *info;
-	struct string_list_item *author, *item;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	char *tmp;
-	struct tm *date;
-	time_t t;
-
-	info = cgit_parse_commit(commit);
-	tmp = xstrdup(info->author);
-	author = string_list_insert(authors, tmp);
-	if (!author->util)
-		author->util = xcalloc(1, sizeof(struct authorstat));
-	else
-		free(tmp);
-	authorstat = author->util;
-	items = &authorstat->list;
-	t = info->committer_date;
-	date = gmtime(&t);
-	period->trunc(date);
-	tmp = xstrdup(period->pretty(date));
-	item = string_list_insert(items, tmp);
-	if (item->util)
-		free(tmp);
-	item->util++;
-	authorstat->total++;
-	cgit_free_commitinfo(info);
+	unsigned long day, *first;
+	time_t now;
+	struct tm *tm;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->nr_periods = period->count;
+	stats->labels = xcalloc(period->count, sizeof(char *));
+	first = xcalloc(period->count + 1, sizeof(unsigned long));
+
+	time(&now);
+	tm = gmtime(&now);
+	period->trunc(tm);
+	for (i = 1; i < period->count; i++)
+		period->dec(tm);
+	for (i = 0; i <= period->count; i++) {
+		first[i] = timegm(tm) / DAY_SECS;
+		if (i < period->count)
+			stats->labels[i] = xstrdup(period->pretty(tm));
+		period->inc(tm);
+	}
+
+	stats->first_day = first[0];
+	stats->nr_days = first[period->count] - first[0];
+	stats->day_period = xmalloc(stats->nr_days);
+	for (i = 0, day = first[0]; i < period->count; i++)
+		for (; day < first[i + 1]; day++)
+			stats->day_period[day - first[0]] = i;
+	free(first);
+
+	stats->table_size = 64;
+	stats->table = xcalloc(stats->table_size, sizeof(int));
 }
 
+static void free_stats(struct authorstats *stats)
+{
+	int i;
+
+	for (i = 0; i < stats->nr; i++)
+		free(stats->authors[i].name);
+	for (i = 0; i < stats->nr_periods; i++)
+		free(stats->labels[i]);
+	free(stats->authors);
+	free(stats->table);
+	free(stats->counts);
+	free(stats->labels);
+	free(stats->day_period);
+	free(stats->order);
+}
+
+static void grow_table(struct authorstats *stats)
+{
+	int i, j;
+
+	free(stats->table);
+	stats->table_size *= 2;
+	stats->table = xcalloc(stats->table_size, sizeof(int));
+	for (i = 0; i < stats->nr; i++) {
+		j = stats->authors[i].hash & (stats->table_size - 1);
+		while (stats->table[j])
+			j = (j + 1) & (stats->table_size - 1);
+		stats->table[j] = i + 1;
+	}
+}
+
+/* Return the index of the author called `name`, adding it if needed */
+static int find_author(struct authorstats *stats, const char *name)
+{
+	struct authorstat *author;
+	unsigned long hash = hash_str(name);
+	int i, j;
+
+	i = hash & (stats->table_size - 1);
+	while ((j = stats->table[i]) != 0) {
+		author = &stats->authors[j - 1];
+		if (author->hash == hash && !strcmp(author->name, name))
+			return j - 1;
+		i = (i + 1) & (stats->table_size - 1);
+	}
+
+	ALLOC_GROW(stats->authors, stats->nr + 1, stats->alloc);
+	author = &stats->authors[stats->nr];
+	author->name = xstrdup(name);
+	author->hash = hash;
+	author->total = 0;
+	ALLOC_GROW(stats->counts, (stats->nr + 1) * stats->nr_periods,
+		   stats->counts_alloc);
+	memset(stats->counts + stats->nr * stats->nr_periods, 0,
+	       stats->nr_periods * sizeof(long));
+	stats->table[i] = ++stats->nr;
+	if (stats->nr * 2 > stats->table_size)
+		grow_table(stats);
+	return stats->nr - 1;
+}
+
+static struct authorstats *sort_stats;
+
 static int cmp_total_commits(const void *a1, const void *a2)
 {
-	const struct string_list_item *i1 = a1;
-	const struct string_list_item *i2 = a2;
-	const struct authorstat *auth1 = i1->util;
-	const struct authorstat *auth2 = i2->util;
+	const struct authorstat *auth1 = &sort_stats->authors[*(const int *)a1];
+	const struct authorstat *auth2 = &sort_stats->authors[*(const int *)a2];
+
+	if (auth1->total != auth2->total)
+		return auth2->total < auth1->total ? -1 : 1;
+	return strcmp(auth1->name, auth2->name);
+}
+
+/* Order the authors by descending number of commits */
+static void sort_authors(struct authorstats *stats)
+{
+	int i;
+
+	stats->order = xmalloc((stats->nr + 1) * sizeof(int));
+	for (i = 0; i < stats->nr; i++)
+		stats->order[i] = i;
+	sort_stats = stats;
+	qsort(stats->order, stats->nr, sizeof(int), cmp_total_commits);
+	sort_stats = NULL;
+}
+
+/* Roll the daily counts of a stats cube up into the periods */
+static void add_cube(struct authorstats *stats, struct stats_cube *cube)
+{
+	const struct stats_cell *cell, *end;
+	int lo = 0, hi = cube->cells_nr, mid, *ids, i;
+	long *count;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cube->cells[mid].day < stats->first_day)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return auth2->total - auth1->total;
+	ids = xmalloc(cube->authors_nr * sizeof(int));
+	for (i = 0; i < cube->authors_nr; i++)
+		ids[i] = -1;
+	end = cube->cells + cube->cells_nr;
+	for (cell = cube->cells + lo; cell < end; cell++) {
+		if (cell->day - stats->first_day >= stats->nr_days)
+			break;
+		if (ids[cell->author] < 0)
+			ids[cell->author] = find_author(stats,
+				cube->authors[cell->author]);
+		count = stats->counts + ids[cell->author] * stats->nr_periods;
+		count[stats->day_period[cell->day - stats->first_day]] +=
+			cell->count;
+		stats->authors[ids[cell->author]].total += cell->count;
+	}
+	free(ids);
 }
 
-/* Walk the commit DAG and collect number of commits per author per
- * timeperiod into a nested string_list collection.
+/* Count the commits per author per timeperiod, either from the stats cube
+ * of the branch or by walking the commit DAG.
  */
-struct string_list collect_stats(struct cgit_context *ctx,
-	struct cgit_period *period)
+static void collect_stats(struct cgit_context *ctx,
+	struct cgit_period *period, struct authorstats *stats)
 {
-	struct string_list authors;
 	struct rev_info rev;
-	struct commit *commit;
+	struct graph_walk walk;
+	struct commit *commit, **commits = NULL;
 	const char *argv[] = {NULL, ctx->qry.head, NULL, NULL, NULL, NULL};
-	int argc = 3;
-	time_t now;
-	long i;
-	struct tm *tm;
+	int argc = 3, use_graph, nr = 0, alloc = 0;
+	time_t since;
 	char tmp[11];
-
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
-	strftime(tmp, sizeof(tmp), "%Y-%m-%d", tm);
+	struct stats_cube cube;
+
+	init_stats(stats, period);
+	if (!ctx->qry.path && !access(ctx->cfg.cache_root, W_OK) &&
+	    !cgit_load_stats_cube(ctx->qry.head, &cube)) {
+		add_cube(stats, &cube);
+		cgit_free_stats_cube(&cube);
+		sort_authors(stats);
+		return;
+	}
+	since = stats->first_day * DAY_SECS;
+	strftime(tmp, sizeof(tmp), "%Y-%m-%d", gmtime(&since));
 	argv[2] = xstrdup(fmt("--since=%s", tmp));
 	if (ctx->qry.path) {
 		argv[3] = "--";
 		argv[4] = ctx->qry.path;
 		argc += 2;
 	}
-	init_revisions(&rev, NULL);
-	rev.abbrev = DEFAULT_ABBREV;
-	rev.commit_format = CMIT_FMT_DEFAULT;
-	rev.no_merges = 1;
-	rev.verbose_header = 1;
-	rev.show_root_diff = 0;
-	setup_revisions(argc, argv, &rev, NULL);
-	prepare_revision_walk(&rev);
-	memset(&authors, 0, sizeof(authors));
-	while ((commit = get_revision(&rev)) != NULL) {
-		add_commit(&authors, commit, period);
+	use_graph = !cgit_graph_walk_setup(&walk, argv[1], ctx->qry.path);
+	if (use_graph) {
+		walk.since = approxidate(tmp);
+		walk.no_merges = 1;
+	} else {
+		init_revisions(&rev, NULL);
+		rev.abbrev = DEFAULT_ABBREV;
+		rev.commit_format = CMIT_FMT_DEFAULT;
+		rev.no_merges = 1;
+		rev.verbose_header = 1;
+		rev.show_root_diff = 0;
+		setup_revisions(argc, argv, &rev, NULL);
+		prepare_revision_walk(&rev);
+	}
+	while ((commit = use_graph ? cgit_graph_walk_next(&walk) :
+		get_revision(&rev)) != NULL) {
 		free(commit->buffer);
+		commit->buffer = NULL;
 		free_commit_list(commit->parents);
+		commit->parents = NULL;
+		ALLOC_GROW(commits, nr + 1, alloc);
+		commits[nr++] = commit;
 	}
-	return authors;
+	if (use_graph)
+		cgit_graph_walk_release(&walk);
+
+	/* The authors are read after the walk, possibly in parallel */
+	memset(&cube, 0, sizeof(cube));
+	cgit_stats_cube_add_commits(&cube, commits, nr);
+	add_cube(stats, &cube);
+	cgit_free_stats_cube(&cube);
+	free(commits);
+	sort_authors(stats);
 }
 
-void print_combined_authorrow(struct string_list *authors, int from, int to,
-	const char *name, const char *leftclass, const char *centerclass,
-	const char *rightclass, struct cgit_period *period)
+static void print_combined_authorrow(struct authorstats *stats, int from,
+	int to, const char *name, const char *leftclass,
+	const char *centerclass, const char *rightclass)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
-	time_t now;
-	long i, j, total, subtotal;
-	struct tm *tm;
-	char *tmp;
-
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
+	long *subtotals, total = 0;
+	const long *row;
+	int i, j;
+
+	subtotals = xcalloc(stats->nr_periods, sizeof(long));
+	for (i = from; i <= to; i++) {
+		row = stats->counts + stats->order[i] * stats->nr_periods;
+		for (j = 0; j < stats->nr_periods; j++)
+			subtotals[j] += row[j];
+	}
 
-	total = 0;
 	htmlf("<tr><td class='%s'>%s</td>", leftclass,
 		fmt(name, to - from + 1));
-	for (j = 0; j < period->count; j++) {
-		tmp = period->pretty(tm);
-		period->inc(tm);
-		subtotal = 0;
-		for (i = from; i <= to; i++) {
-			author = &authors->items[i];
-			authorstat = author->util;
-			items = &authorstat->list;
-			date = string_list_lookup(items, tmp);
-			if (date)
-				subtotal += (size_t)date->util;
-		}
-		htmlf("<td class='%s'>%d</td>", centerclass, subtotal);
-		total += subtotal;
+	for (j = 0; j < stats->nr_periods; j++) {
+		htmlf("<td class='%s'>%ld</td>", centerclass, subtotals[j]);
+		total += subtotals[j];
 	}
-	htmlf("<td class='%s'>%d</td></tr>", rightclass, total);
+	htmlf("<td class='%s'>%ld</td></tr>", rightclass, total);
+	free(subtotals);
 }
 
-void print_authors(struct string_list *authors, int top,
-		   struct cgit_period *period)
+static void print_authors(struct authorstats *stats, int top)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
-	time_t now;
-	long i, j, total;
-	struct tm *tm;
-	char *tmp;
-
-	time(&now);
-	tm = gmtime(&now);
-	period->trunc(tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(tm);
+	const long *row;
+	long total;
+	int i, j;
 
 	html("<table class='stats'><tr><th>Author</th>");
-	for (j = 0; j < period->count; j++) {
-		tmp = period->pretty(tm);
-		htmlf("<th>%s</th>", tmp);
-		period->inc(tm);
-	}
+	for (j = 0; j < stats->nr_periods; j++)
+		htmlf("<th>%s</th>", stats->labels[j]);
 	html("<th>Total</th></tr>\n");
 
-	if (top <= 0 || top > authors->nr)
-		top = authors->nr;
+	if (top <= 0 || top > stats->nr)
+		top = stats->nr;
 
 	for (i = 0; i < top; i++) {
-		author = &authors->items[i];
 		html("<tr><td class='left'>");
-		html_txt(author->string);
+		html_txt(stats->authors[stats->order[i]].name);
 		html("</td>");
-		authorstat = author->util;
-		items = &authorstat->list;
+		row = stats->counts + stats->order[i] * stats->nr_periods;
 		total = 0;
-		for (j = 0; j < period->count; j++)
-			period->dec(tm);
-		for (j = 0; j < period->count; j++) {
-			tmp = period->pretty(tm);
-			period->inc(tm);
-			date = string_list_lookup(items, tmp);
-			if (!date)
-				html("<td>0</td>");
-			else {
-				htmlf("<td>%d</td>", date->util);
-				total += (size_t)date->util;
-			}
+		for (j = 0; j < stats->nr_periods; j++) {
+			htmlf("<td>%ld</td>", row[j]);
+			total += row[j];
 		}
-		htmlf("<td class='sum'>%d</td></tr>", total);
+		htmlf("<td class='sum'>%ld</td></tr>", total);
 	}
 
-	if (top < authors->nr)
-		print_combined_authorrow(authors, top, authors->nr - 1,
-			"Others (%d)", "left", "", "sum", period);
+	if (top < stats->nr)
+		print_combined_authorrow(stats, top, stats->nr - 1,
+			"Others (%d)", "left", "", "sum");
 
-	print_combined_authorrow(authors, 0, authors->nr - 1, "Total",
-		"total", "sum", "sum", period);
+	print_combined_authorrow(stats, 0, stats->nr - 1, "Total",
+		"total", "sum", "sum");
 	html("</table>");
 }
 
-/* Create a sorted string_list with one entry per author. The util-field
- * for each author is another string_list which is used to calculate the
- * number of commits per time-interval.
+/* Count the commits per author per period, then print a table with the
+ * most active authors sorted by their total number of commits.
  */
 void cgit_show_stats(struct cgit_context *ctx)
 {
-	struct string_list authors;
+	struct authorstats stats;
 	struct cgit_period *period;
 	int top, i;
 	const char *code = "w";
@@ -375,9 +490,7 @@ void cgit_show_stats(struct cgit_context *ctx)
 				     period->name));
 		return;
 	}
-	authors = collect_stats(ctx, period);
-	qsort(authors.items, authors.nr, sizeof(struct string_list_item),
-		cmp_total_commits);
+	collect_stats(ctx, period, &stats);
 
 	top = ctx->qry.ofs;
 	if (!top)
@@ -413,6 +526,7 @@ void cgit_show_stats(struct cgit_context *ctx)
 	html("</select>");
 	html("<noscript>&nbsp;&nbsp;<input type='submit' value='Reload'/></noscript>");
 	html("</form>");
-	print_authors(&authors, top, period);
+	print_authors(&stats, top);
+	free_stats(&stats);
 }
 
@@ -10,11 +10,24 @@
 #include "cgit.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "tree-sizes.h"
+#include "blame-tree.h"
 
 char *curr_rev;
-char *match_path;
 int header = 0;
 
+/* The entries of the tree being listed, collected so that their sizes can
+ * be looked up in one batch before the listing is printed.
+ */
+static struct ls_entry {
+	char *name;
+	unsigned char sha1[20];
+	unsigned int mode;
+} *entries;
+static int entries_nr, entries_alloc;
+static unsigned char listed_tree[20];
+static struct commit *listed_commit;
+
 static void print_text_buffer(const char *name, char *buf, unsigned long size)
 {
 	unsigned long lineno, idx;
@@ -120,28 +133,33 @@ static void print_object(const unsigned char *sha1, char *path, const char *base
 }
 
 
-static int ls_item(const unsigned char *sha1, const char *base, int baselen,
-		   const char *pathname, unsigned int mode, int stage,
-		   void *cbdata)
+static void print_lastcommit(struct blame_tree_entry *blame)
+{
+	html("<td class='ls-commit'>");
+	if (!is_null_sha1(blame->commit))
+		cgit_commit_link(blame->subject, NULL, NULL, ctx.qry.head,
+				 sha1_to_hex(blame->commit), NULL, 0);
+	html("</td><td class='ls-age'>");
+	if (!is_null_sha1(blame->commit))
+		cgit_print_age(blame->date, TM_WEEK * 2, FMT_SHORTDATE);
+	html("</td>");
+}
+
+static void ls_item(const unsigned char *sha1, const char *name,
+		    unsigned int mode, struct tree_size *size,
+		    struct blame_tree_entry *blame)
 {
-	char *name;
 	char *fullpath;
 	char *class;
-	enum object_type type;
-	unsigned long size = 0;
 
-	name = xstrdup(pathname);
 	fullpath = fmt("%s%s%s", ctx.qry.path ? ctx.qry.path : "",
 		       ctx.qry.path ? "/" : "", name);
 
-	if (!S_ISGITLINK(mode)) {
-		type = sha1_object_info(sha1, &size);
-		if (type == OBJ_BAD) {
-			htmlf("<tr><td colspan='3'>Bad object: %s %s</td></tr>",
-			      name,
-			      sha1_to_hex(sha1));
-			return 0;
-		}
+	if (size->type == OBJ_BAD) {
+		htmlf("<tr><td colspan='3'>Bad object: %s %s</td></tr>",
+		      name,
+		      sha1_to_hex(sha1));
+		return;
 	}
 
 	html("<tr><td class='ls-mode'>");
@@ -167,7 +185,9 @@ static int ls_item(const unsigned char *sha1, const char *base, int baselen,
 		cgit_tree_link(name, NULL, class, ctx.qry.head,
 			       curr_rev, fullpath);
 	}
-	htmlf("</td><td class='ls-size'>%li</td>", size);
+	htmlf("</td><td class='ls-size'>%li</td>", size->size);
+	if (blame)
+		print_lastcommit(blame);
 
 	html("<td>");
 	cgit_log_link("log", NULL, "button", ctx.qry.head, curr_rev,
@@ -178,10 +198,57 @@ static int ls_item(const unsigned char *sha1, const char *base, int baselen,
 	cgit_plain_link("plain", NULL, "button", ctx.qry.head, curr_rev,
 			fullpath);
 	html("</td></tr>\n");
-	free(name);
+}
+
+static int collect_item(const unsigned char *sha1, const char *base,
+			int baselen, const char *pathname, unsigned int mode,
+			int stage, void *cbdata)
+{
+	struct ls_entry *entry;
+
+	ALLOC_GROW(entries, entries_nr + 1, entries_alloc);
+	entry = &entries[entries_nr++];
+	entry->name = xstrdup(pathname);
+	hashcpy(entry->sha1, sha1);
+	entry->mode = mode;
 	return 0;
 }
 
+/* Print the collected entries of `listed_tree` */
+static void ls_items()
+{
+	struct tree_size *sizes;
+	struct blame_tree_entry *blames = NULL;
+	int i;
+
+	sizes = xcalloc(entries_nr, sizeof(*sizes));
+	for (i = 0; i < entries_nr; i++) {
+		if (S_ISGITLINK(entries[i].mode))
+			continue;
+		sizes[i].sha1 = entries[i].sha1;
+		sizes[i].type = S_ISDIR(entries[i].mode) ? OBJ_TREE : OBJ_BLOB;
+	}
+	cgit_tree_sizes(listed_tree, sizes, entries_nr);
+	if (ctx.repo->enable_tree_lastcommit && listed_commit) {
+		blames = xcalloc(entries_nr, sizeof(*blames));
+		for (i = 0; i < entries_nr; i++)
+			blames[i].name = entries[i].name;
+		cgit_blame_tree(listed_commit, ctx.qry.path, listed_tree,
+				blames, entries_nr);
+	}
+	for (i = 0; i < entries_nr; i++)
+		ls_item(entries[i].sha1, entries[i].name, entries[i].mode,
+			&sizes[i], blames ? &blames[i] : NULL);
+	if (blames) {
+		cgit_free_blame_tree(blames, entries_nr);
+		free(blames);
+	}
+	for (i = 0; i < entries_nr; i++)
+		free(entries[i].name);
+	free(sizes);
+	entries_nr = 0;
+}
+
 static void ls_head()
 {
 	html("<table summary='tree listing' class='list'>\n");
@@ -189,6 +256,10 @@ static void ls_head()
 	html("<th class='left'>Mode</th>");
 	html("<th class='left'>Name</th>");
 	html("<th class='right'>Size</th>");
+	if (ctx.repo->enable_tree_lastcommit && listed_commit) {
+		html("<th class='left'>Last commit</th>");
+		html("<th class='left'>Age</th>");
+	}
 	html("<th/>");
 	html("</tr>\n");
 	header = 1;
@@ -214,38 +285,13 @@ static void ls_tree(const unsigned char *sha1, char *path)
 	}
 
 	ls_head();
-	read_tree_recursive(tree, "", 0, 1, NULL, ls_item, NULL);
+	hashcpy(listed_tree, tree->object.sha1);
+	read_tree_recursive(tree, "", 0, 1, NULL, collect_item, NULL);
+	ls_items();
 	ls_tail();
 }
 
 
-static int walk_tree(const unsigned char *sha1, const char *base, int baselen,
-		     const char *pathname, unsigned mode, int stage,
-		     void *cbdata)
-{
-	static int state;
-	static char buffer[PATH_MAX];
-
-	if (state == 0) {
-		memcpy(buffer, base, baselen);
-		strcpy(buffer+baselen, pathname);
-		if (strcmp(match_path, buffer))
-			return READ_TREE_RECURSIVE;
-
-		if (S_ISDIR(mode)) {
-			state = 1;
-			ls_head();
-			return READ_TREE_RECURSIVE;
-		} else {
-			print_object(sha1, buffer, pathname);
-			return 0;
-		}
-	}
-	ls_item(sha1, base, baselen, pathname, mode, stage, NULL);
-	return 0;
-}
-
-
 /*
  * Show a tree or a blob
  *   rev:  the commit pointing at the root tree object
@@ -253,9 +299,10 @@ static int walk_tree(const unsigned char *sha1, const char *base, int baselen,
  */
 void cgit_print_tree(const char *rev, char *path)
 {
-	unsigned char sha1[20];
+	unsigned char sha1[20], sha1_path[20];
 	struct commit *commit;
-	const char *paths[] = {path, NULL};
+	char *errmsg = NULL, *name;
+	int mode;
 
 	if (!rev)
 		rev = ctx.qry.head;
@@ -271,12 +318,20 @@ void cgit_print_tree(const char *rev, char *path)
 		return;
 	}
 
+	listed_commit = commit;
 	if (path == NULL) {
 		ls_tree(commit->tree->object.sha1, NULL);
 		return;
 	}
 
-	match_path = path;
-	read_tree_recursive(commit->tree, "", 0, 0, paths, walk_tree, NULL);
-	ls_tail();
+	if (cgit_find_object_by_path(commit->tree->object.sha1, path, 0,
+				     sha1_path, &mode, &errmsg)) {
+		cgit_print_error(errmsg);
+		free(errmsg);
+	} else if (S_ISDIR(mode))
+		ls_tree(sha1_path, path);
+	else {
+		name = strrchr(path, '/');
+		print_object(sha1_path, path, name ? name + 1 : path);
+	}
 }